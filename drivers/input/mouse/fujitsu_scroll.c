@@ -18,22 +18,70 @@
 #include <linux/libps2.h>
 #include <linux/rmi.h>
 #include <linux/slab.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
+#include <linux/bitops.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/rcupdate.h>
+#include <linux/reciprocal_div.h>
 #include "psmouse.h"
 #include "fujitsu_scroll.h"
 
 #ifdef CONFIG_MOUSE_PS2_FUJITSU_SCROLL
 
+static struct dentry *fujitsu_scroll_debugfs_root;
+
 static short fujitsu_capacitance = FJS_CAPACITANCE_THRESHOLD;
 static short fujitsu_speed = FJS_SPEED;
 
 module_param(fujitsu_capacitance, short, 0644);
-MODULE_PARM_DESC(fujitsu_capaciance, "Capacitance threshold");
+MODULE_PARM_DESC(fujitsu_capacitance, "Default capacitance threshold of newly connected devices.");
 module_param(fujitsu_speed, short, 0644);
-MODULE_PARM_DESC(fujitsu_speed, "Speed.");
+MODULE_PARM_DESC(fujitsu_speed, "Default speed of newly connected devices.");
+
+static unsigned short fujitsu_keys[FJS_MAX_EXTRA_CODES];
+static unsigned int fujitsu_num_keys;
+static unsigned short fujitsu_rels[FJS_MAX_EXTRA_CODES];
+static unsigned int fujitsu_num_rels;
+
+module_param_array(fujitsu_keys, ushort, &fujitsu_num_keys, 0444);
+MODULE_PARM_DESC(fujitsu_keys, "Key codes the event maps may use besides the default ones.");
+module_param_array(fujitsu_rels, ushort, &fujitsu_num_rels, 0444);
+MODULE_PARM_DESC(fujitsu_rels, "Relative axes the event maps may use besides the wheel axes.");
+
+static bool fujitsu_merge;
+
+module_param(fujitsu_merge, bool, 0444);
+MODULE_PARM_DESC(fujitsu_merge, "Report the Scroll Wheel and the Scroll Sensor through a single input device.");
+
+static bool fujitsu_force;
+
+module_param(fujitsu_force, bool, 0644);
+MODULE_PARM_DESC(fujitsu_force, "Probe for the devices even if DMI does not name Fujitsu as the system vendor.");
+
+static DEFINE_MUTEX(fujitsu_scroll_shared_mutex);
+static struct fujitsu_scroll_shared *fujitsu_scroll_shared;
+
+/* Keeps open and close of a port's own input device off a disconnect */
+static DEFINE_MUTEX(fujitsu_scroll_open_mutex);
+
+void fujitsu_scroll_module_init(void)
+{
+	fujitsu_scroll_debugfs_root =
+		debugfs_create_dir("fujitsu_scroll", NULL);
+}
+
+void fujitsu_scroll_module_exit(void)
+{
+	debugfs_remove_recursive(fujitsu_scroll_debugfs_root);
+}
 
 int fujitsu_scroll_detect(struct psmouse *psmouse, bool set_properties)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	u8 param[4] = { 0 };
 
 #if defined(CONFIG_DMI) && defined(CONFIG_X86)
@@ -46,15 +94,15 @@ int fujitsu_scroll_detect(struct psmouse *psmouse, bool set_properties)
 		{ }
 	};
 
-	if (!dmi_check_system(present_dmi_table))
+	if (!fujitsu_force && !dmi_check_system(present_dmi_table))
 		return -ENODEV;
 #endif
 
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETINFO);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETINFO);
 
 	if (param[1] != FUJITSU_SCROLL_ID)
 		return -ENODEV;
@@ -78,162 +126,2623 @@ int fujitsu_scroll_detect(struct psmouse *psmouse, bool set_properties)
 	return 0;
 }
 
-static void fujitsu_scroll_init_sequence(struct psmouse *psmouse)
+/*
+ * The mode byte the device should be running with: data packets are
+ * only wanted while somebody is listening, and only as much of them
+ * as the operating mode asks for.
+ */
+static u8 fujitsu_scroll_wanted_mode(struct fujitsu_scroll_data *priv)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
-	u8 param[4] = { 0 };
+	if (!READ_ONCE(priv->open) ||
+	    READ_ONCE(priv->yielding) == FJS_YIELD_OFF)
+		return FJS_INIT_MODE & ~FJS_MODE_ENABLE;
+
+	switch (priv->op_mode) {
+	case FUJITSU_SCROLL_PRESS_ONLY:
+		return FJS_INIT_MODE | FJS_MODE_PRESS_ONLY;
+	case FUJITSU_SCROLL_OFF:
+		return FJS_INIT_MODE & ~FJS_MODE_ENABLE;
+	default:
+		return FJS_INIT_MODE;
+	}
+}
+
+static const u8 fujitsu_scroll_rates[FJS_NUM_RATES] = {
+	200, 100, 80, 60, 40, 20, 10
+};
+
+/* Index of the highest report rate not above the given one */
+static unsigned int fujitsu_scroll_rate_index(unsigned int rate)
+{
+	unsigned int i = 0;
+
+	while (i < FJS_NUM_RATES - 1 && fujitsu_scroll_rates[i] > rate)
+		i++;
+
+	return i;
+}
+
+static u8 fujitsu_scroll_wanted_rate(struct fujitsu_scroll_data *priv)
+{
+	unsigned int rate = priv->psmouse->rate;
+
+	if (READ_ONCE(priv->yielding) == FJS_YIELD_RATE)
+		rate = min(rate, FJS_YIELD_REPORT_RATE);
+
+	return fujitsu_scroll_rates[fujitsu_scroll_rate_index(rate)];
+}
+
+static void fujitsu_scroll_send_rate(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	u8 rate = fujitsu_scroll_wanted_rate(priv);
+
+	if (psmouse_command(psmouse, &rate, PSMOUSE_CMD_SETRATE))
+		return;
+
+	priv->rate = rate;
+	WRITE_ONCE(priv->rate_index, fujitsu_scroll_rate_index(rate));
+}
+
+static int fujitsu_scroll_send_mode(struct psmouse *psmouse, u8 mode)
+{
+	u8 param = FJS_MODE_RATE;
 	int error;
 
-	error = ps2_sliced_command(ps2dev, FJS_INIT_MODE);
-	param[0] = 0x14;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	error = psmouse_sliced_command(psmouse, mode);
+	if (error)
+		return error;
+
+	return psmouse_command(psmouse, &param, PSMOUSE_CMD_SETRATE);
+}
+
+static void fujitsu_scroll_reset_touch(struct fujitsu_scroll_data *priv);
+
+/* Sends the wanted mode byte, re-arming the device first if asked to */
+static int fujitsu_scroll_switch_mode(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	u8 mode;
+
+	/* Taking a stuck device out of data mode for a moment unsticks it */
+	if (READ_ONCE(priv->rearm)) {
+		fujitsu_scroll_send_mode(psmouse,
+					 FJS_INIT_MODE & ~FJS_MODE_ENABLE);
+		WRITE_ONCE(priv->rearm, false);
+	}
+
+	mode = fujitsu_scroll_wanted_mode(priv);
+	if (fujitsu_scroll_send_mode(psmouse, mode)) {
+		psmouse_warn(psmouse, "failed to set mode 0x%02x\n", mode);
+		return -EIO;
+	}
+
+	priv->mode = mode;
+	return 0;
+}
+
+static void fujitsu_scroll_init_sequence(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+
+	lockdep_assert_held(&priv->mode_mutex);
+
+	fujitsu_scroll_reset_touch(priv);
+
+	if (!fujitsu_scroll_switch_mode(psmouse))
+		fujitsu_scroll_send_rate(psmouse);
+}
+
+static bool fujitsu_scroll_mode_byte_stale(struct fujitsu_scroll_data *priv)
+{
+	return priv->mode != fujitsu_scroll_wanted_mode(priv) ||
+	       READ_ONCE(priv->rearm);
+}
+
+static bool fujitsu_scroll_mode_stale(struct fujitsu_scroll_data *priv)
+{
+	return fujitsu_scroll_mode_byte_stale(priv) ||
+	       priv->rate != fujitsu_scroll_wanted_rate(priv);
+}
+
+/*
+ * Sends only what is out of date: the mode byte (with its terminating
+ * SET RATE) and the report rate are independent, so opening or closing
+ * the device costs just the former.  Either way the touch in progress
+ * is forgotten.
+ */
+static void fujitsu_scroll_update_mode(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	bool mode, rate;
+
+	lockdep_assert_held(&priv->mode_mutex);
+
+	mode = fujitsu_scroll_mode_byte_stale(priv);
+	rate = priv->rate != fujitsu_scroll_wanted_rate(priv);
+	if (!mode && !rate)
+		return;
+
+	fujitsu_scroll_reset_touch(priv);
+
+	if (mode && fujitsu_scroll_switch_mode(psmouse))
+		return;
+
+	if (rate)
+		fujitsu_scroll_send_rate(psmouse);
+}
+
+/*
+ * psmouse sets rate, resolution and scaling after init and reconnect,
+ * and from its sysfs attributes, with the device deactivated.  The rate
+ * is the device's report rate and only sent if it changed.  Resolution
+ * and scaling mean nothing to a device reporting absolute positions, and
+ * SET RESOLUTION is what sliced commands are made of, so neither is ever
+ * sent.
+ */
+static void fujitsu_scroll_set_rate(struct psmouse *psmouse, unsigned int rate)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+
+	psmouse->rate = fujitsu_scroll_rates[fujitsu_scroll_rate_index(rate)];
+
+	mutex_lock(&priv->mode_mutex);
+	fujitsu_scroll_update_mode(psmouse);
+	mutex_unlock(&priv->mode_mutex);
+}
+
+static void fujitsu_scroll_set_resolution(struct psmouse *psmouse,
+					  unsigned int resolution)
+{
+	psmouse->resolution = resolution;
+}
+
+static void fujitsu_scroll_set_scale(struct psmouse *psmouse,
+				     enum psmouse_scale scale)
+{
 }
 
 static int fujitsu_scroll_query_hardware(struct psmouse *psmouse)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	struct fujitsu_scroll_data *priv = psmouse->private;
 	u8 param[4];
 
-	ps2_sliced_command(ps2dev, 0);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETINFO);
+	psmouse_sliced_command(psmouse, 0);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETINFO);
 
-	if (param[0] == FUJITSU_SCROLL_WHEEL_ID) {
+	if (param[0] == FUJITSU_SCROLL_WHEEL_ID)
 		priv->type = FUJITSU_SCROLL_WHEEL;
-		priv->axis = FJS_WHEEL_AXIS;
-	} else {
+	else
 		priv->type = FUJITSU_SCROLL_SENSOR;
-		priv->axis = FJS_SENSOR_AXIS;
-	}
 
 	return 0;
 }
 
 /*****************************************************************************
- *	Functions to interpret the packets
+ *	Per-device settings
  ****************************************************************************/
 
 /*
- *  called for each full received packet from the device
+ * Settings are only replaced from sysfs stores, which psmouse serializes
+ * with psmouse_mutex, so writers need no further locking.
  */
-static void fujitsu_scroll_process_packet(struct psmouse *psmouse)
+static struct fujitsu_scroll_settings *
+fujitsu_scroll_cur_settings(struct fujitsu_scroll_data *priv)
+{
+	return rcu_dereference_protected(priv->settings, true);
+}
+
+static struct fujitsu_scroll_settings *
+fujitsu_scroll_dup_settings(struct fujitsu_scroll_data *priv)
+{
+	return kmemdup(fujitsu_scroll_cur_settings(priv),
+		       sizeof(struct fujitsu_scroll_settings), GFP_KERNEL);
+}
+
+static void fujitsu_scroll_build_stages(struct fujitsu_scroll_data *priv,
+					struct fujitsu_scroll_settings *s);
+
+static void fujitsu_scroll_update_derived(struct fujitsu_scroll_data *priv,
+					  struct fujitsu_scroll_settings *s)
+{
+	s->speed_recip = reciprocal_value(s->speed);
+	s->storm_packets = DIV_ROUND_UP(s->storm_rate * FJS_STORM_WINDOW, HZ);
+	fujitsu_scroll_build_stages(priv, s);
+}
+
+static void fujitsu_scroll_publish(struct fujitsu_scroll_data *priv,
+				   struct fujitsu_scroll_settings *new)
+{
+	struct fujitsu_scroll_settings *old = fujitsu_scroll_cur_settings(priv);
+
+	fujitsu_scroll_update_derived(priv, new);
+	rcu_assign_pointer(priv->settings, new);
+	kfree_rcu(old, rcu);
+}
+
+static void fujitsu_scroll_cal_identity(u16 *cal)
+{
+	int i;
+
+	for (i = 0; i < FJS_CAL_KNOTS; i++)
+		cal[i] = i * FJS_CAL_STEP;
+}
+
+static int fujitsu_scroll_init_settings(struct psmouse *psmouse)
 {
-	struct input_dev *dev = psmouse->dev;
 	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_settings *s;
 
-	unsigned int capacitance;
-	unsigned int position;
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return -ENOMEM;
 
-	int movement;
-	int speed;
-	int roll;
+	s->threshold = clamp_t(int, READ_ONCE(fujitsu_capacitance),
+			       1, FJS_MAX_CAPACITANCE);
+	s->speed = clamp_t(int, READ_ONCE(fujitsu_speed), 1, FJS_RANGE);
+	s->map[FJS_EVENT_UP].type = EV_REL;
+	s->map[FJS_EVENT_UP].code = priv->type == FUJITSU_SCROLL_WHEEL ?
+					FJS_WHEEL_AXIS : FJS_SENSOR_AXIS;
+	s->map[FJS_EVENT_DOWN] = s->map[FJS_EVENT_UP];
+	s->map[FJS_EVENT_PRESS].type = EV_KEY;
+	s->map[FJS_EVENT_PRESS].code =
+		priv->shared && priv->type == FUJITSU_SCROLL_SENSOR ?
+			FJS_SENSOR_MERGED_BUTTON : FJS_PRESS_BUTTON;
+	s->storm_rate = FJS_STORM_RATE;
+	s->continuous_rate = FJS_CONTINUOUS_RATE;
+	s->edge_zone = FJS_EDGE_ZONE;
+	s->fast_scroll = FJS_FAST_SCROLL;
+	fujitsu_scroll_cal_identity(s->cal);
+	fujitsu_scroll_update_derived(priv, s);
 
-	position = ((psmouse->packet[1] & 0x0f) << 8) + psmouse->packet[2];
-	capacitance = psmouse->packet[0] & 0x3f;
+	RCU_INIT_POINTER(priv->settings, s);
+	return 0;
+}
 
-	if (capacitance >= fujitsu_capacitance) {
-		if (!priv->finger_down) {
-			priv->finger_down = 1;
-			priv->last_event_position = position;
-		} else {
-			if (priv->type == FUJITSU_SCROLL_WHEEL) {	// scroll wheel
-				if (position > priv->last_event_position) {
-					movement =
-					    position -
-					    priv->last_event_position;
-					if (movement > FJS_MAX_POS_CHG) {
-						movement =
-						    -(FJS_RANGE - movement);
-					}
-				} else {
-					movement =
-					    -(priv->last_event_position -
-					      position);
-					if (movement < -FJS_MAX_POS_CHG)
-						movement += FJS_RANGE;
-				}
-			} else {	// scroll sensor
-				movement = position - priv->last_event_position;
-			}
+/* valid, if set, further restricts the values of a tunable */
+struct fujitsu_scroll_param {
+	size_t offset;
+	unsigned int min;
+	unsigned int max;
+	bool (*valid)(unsigned int value);
+};
 
-			priv->last_event_position = position;
-			priv->movement += movement;
-			
-			speed = fujitsu_speed;
-			if ( speed < 1 )
-			{ // not to divide by 0
-				speed = 1;
-			}
-			
-			roll = priv->movement / speed;
-			priv->movement -= roll * speed;
-			
-			if ( roll != 0 )
-			{
-				input_report_rel(dev, priv->axis, -roll);
-			}
-		}
-	} else if (priv->finger_down == 1) {
-		priv->finger_down = 0;
-	}
+static ssize_t fujitsu_scroll_show_param(struct psmouse *psmouse,
+					 void *data, char *buf)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	const struct fujitsu_scroll_param *param = data;
+	const struct fujitsu_scroll_settings *s;
+	unsigned int value;
 
-	input_sync(dev);
+	rcu_read_lock();
+	s = rcu_dereference(priv->settings);
+	value = *(const unsigned int *)((const char *)s + param->offset);
+	rcu_read_unlock();
+
+	return sprintf(buf, "%u\n", value);
 }
 
-static psmouse_ret_t fujitsu_scroll_process_byte(struct psmouse *psmouse)
+static ssize_t fujitsu_scroll_set_param(struct psmouse *psmouse, void *data,
+					const char *buf, size_t count)
 {
-	if (psmouse->pktcnt >= FJS_PACKET_SIZE) {	/* Full packet received */
-		fujitsu_scroll_process_packet(psmouse);
-		return PSMOUSE_FULL_PACKET;
-	}
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	const struct fujitsu_scroll_param *param = data;
+	struct fujitsu_scroll_settings *new;
+	unsigned int value;
+	int err;
 
-	return PSMOUSE_GOOD_DATA;
+	err = kstrtouint(buf, 10, &value);
+	if (err)
+		return err;
+
+	if (value < param->min || value > param->max ||
+	    (param->valid && !param->valid(value)))
+		return -EINVAL;
+
+	new = fujitsu_scroll_dup_settings(priv);
+	if (!new)
+		return -ENOMEM;
+
+	*(unsigned int *)((char *)new + param->offset) = value;
+	fujitsu_scroll_publish(priv, new);
+
+	return count;
 }
 
-/*****************************************************************************
- *	Driver initialization/cleanup functions
- ****************************************************************************/
+/*
+ * The tunables do not talk to the device, so there is no need to
+ * disable it while they are written.
+ */
+#define FUJITSU_SCROLL_PARAM_ATTR(_name, _min, _max)				\
+	static struct fujitsu_scroll_param fujitsu_scroll_param_##_name = {	\
+		.offset	= offsetof(struct fujitsu_scroll_settings, _name),	\
+		.min	= _min,							\
+		.max	= _max,							\
+	};									\
+	__PSMOUSE_DEFINE_ATTR(_name, S_IWUSR | S_IRUGO,				\
+			      &fujitsu_scroll_param_##_name,			\
+			      fujitsu_scroll_show_param,			\
+			      fujitsu_scroll_set_param, false)
 
-static void fujitsu_scroll_disconnect(struct psmouse *psmouse)
+FUJITSU_SCROLL_PARAM_ATTR(threshold, 1, FJS_MAX_CAPACITANCE);
+FUJITSU_SCROLL_PARAM_ATTR(speed, 1, FJS_RANGE);
+FUJITSU_SCROLL_PARAM_ATTR(invert, 0, 1);
+FUJITSU_SCROLL_PARAM_ATTR(filter, 0, FJS_MAX_FILTER);
+FUJITSU_SCROLL_PARAM_ATTR(accel, 0, FJS_MAX_ACCEL);
+FUJITSU_SCROLL_PARAM_ATTR(storm_rate, 0, FJS_MAX_STORM_RATE);
+FUJITSU_SCROLL_PARAM_ATTR(timestamp, 0, 1);
+
+static const unsigned short fujitsu_scroll_dpad_keys[][FJS_DPAD_SECTORS] = {
+	{ KEY_UP, KEY_RIGHT, KEY_DOWN, KEY_LEFT },
+	{ BTN_DPAD_UP, BTN_DPAD_RIGHT, BTN_DPAD_DOWN, BTN_DPAD_LEFT },
+};
+
+/*
+ * types is a mask of the device types that report through dev.  What
+ * the map can be set to is what dev advertises: its capabilities never
+ * change once it is registered, so besides the codes of the default
+ * map and of the axis attribute, those are only the ones given in the
+ * fujitsu_keys and fujitsu_rels module parameters when it was created.
+ */
+static void fujitsu_scroll_set_caps(struct input_dev *dev, unsigned int types)
+{
+	int i, j;
+
+	input_set_capability(dev, EV_REL, REL_WHEEL);
+	input_set_capability(dev, EV_REL, REL_HWHEEL);
+	input_set_capability(dev, EV_KEY, FJS_PRESS_BUTTON);
+	if (types == (BIT(FUJITSU_SCROLL_WHEEL) | BIT(FUJITSU_SCROLL_SENSOR)))
+		input_set_capability(dev, EV_KEY, FJS_SENSOR_MERGED_BUTTON);
+
+	for (i = 0; i < fujitsu_num_keys; i++)
+		if (fujitsu_keys[i] && fujitsu_keys[i] <= KEY_MAX)
+			input_set_capability(dev, EV_KEY, fujitsu_keys[i]);
+
+	for (i = 0; i < fujitsu_num_rels; i++)
+		if (fujitsu_rels[i] <= REL_MAX)
+			input_set_capability(dev, EV_REL, fujitsu_rels[i]);
+
+	/* Either key set, dpad_buttons may switch between them later */
+	if (types & BIT(FUJITSU_SCROLL_WHEEL))
+		for (i = 0; i < ARRAY_SIZE(fujitsu_scroll_dpad_keys); i++)
+			for (j = 0; j < FJS_DPAD_SECTORS; j++)
+				input_set_capability(dev, EV_KEY,
+					fujitsu_scroll_dpad_keys[i][j]);
+
+	/* Slider levels are scaled to the full range, whatever their number */
+	if (types & BIT(FUJITSU_SCROLL_SENSOR))
+		input_set_abs_params(dev, FJS_SLIDER_AXIS,
+				     0, FJS_MAX_SLIDER_LEVELS - 1, 0, 0);
+
+	/* Advertised up front, the timestamp tunable may turn it on later */
+	input_set_capability(dev, EV_MSC, MSC_TIMESTAMP);
+}
+
+static bool fujitsu_scroll_map_valid(struct fujitsu_scroll_data *priv,
+				     const struct fujitsu_scroll_action *a)
+{
+	switch (a->type) {
+	case EV_KEY:
+		return test_bit(a->code, priv->dev->keybit);
+	case EV_REL:
+		return test_bit(a->code, priv->dev->relbit);
+	default:
+		return !a->type;
+	}
+}
+
+/* Maps the given events to a new action */
+static int fujitsu_scroll_update_map(struct psmouse *psmouse,
+				     unsigned long events,
+				     const struct fujitsu_scroll_action *action)
 {
 	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_settings *new;
+	int i;
 
-	psmouse_reset(psmouse);
-	kfree(priv);
-	psmouse->private = NULL;
+	if (!fujitsu_scroll_map_valid(priv, action))
+		return -EINVAL;
+
+	new = fujitsu_scroll_dup_settings(priv);
+	if (!new)
+		return -ENOMEM;
+
+	for_each_set_bit(i, &events, FJS_NUM_EVENTS)
+		new->map[i] = *action;
+
+	fujitsu_scroll_publish(priv, new);
+
+	return 0;
 }
 
-static int fujitsu_scroll_reconnect(struct psmouse *psmouse)
+static bool fujitsu_scroll_dpad_valid(unsigned int value)
 {
-	psmouse_reset(psmouse);
-	fujitsu_scroll_init_sequence(psmouse);
+	return value == 0 || value == FJS_DPAD_SECTORS ||
+	       value == 2 * FJS_DPAD_SECTORS;
+}
+
+static struct fujitsu_scroll_param fujitsu_scroll_param_dpad = {
+	.offset	= offsetof(struct fujitsu_scroll_settings, dpad),
+	.max	= 2 * FJS_DPAD_SECTORS,
+	.valid	= fujitsu_scroll_dpad_valid,
+};
+
+__PSMOUSE_DEFINE_ATTR(dpad, S_IWUSR | S_IRUGO,
+		      &fujitsu_scroll_param_dpad,
+		      fujitsu_scroll_show_param,
+		      fujitsu_scroll_set_param, false);
+
+FUJITSU_SCROLL_PARAM_ATTR(dpad_buttons, 0, 1);
+FUJITSU_SCROLL_PARAM_ATTR(dpad_repeat, 0, FJS_MAX_DPAD_REPEAT);
+
+static bool fujitsu_scroll_slider_valid(unsigned int value)
+{
+	return value != 1;
+}
+
+static struct fujitsu_scroll_param fujitsu_scroll_param_slider = {
+	.offset	= offsetof(struct fujitsu_scroll_settings, slider),
+	.max	= FJS_MAX_SLIDER_LEVELS,
+	.valid	= fujitsu_scroll_slider_valid,
+};
+
+__PSMOUSE_DEFINE_ATTR(slider, S_IWUSR | S_IRUGO,
+		      &fujitsu_scroll_param_slider,
+		      fujitsu_scroll_show_param,
+		      fujitsu_scroll_set_param, false);
+
+FUJITSU_SCROLL_PARAM_ATTR(continuous, 0, 1);
+FUJITSU_SCROLL_PARAM_ATTR(continuous_rate, 1, FJS_MAX_CONTINUOUS_RATE);
+FUJITSU_SCROLL_PARAM_ATTR(edge_zone, 0, FJS_MAX_POS_CHG);
+FUJITSU_SCROLL_PARAM_ATTR(gestures, 0, 1);
+FUJITSU_SCROLL_PARAM_ATTR(fast_scroll, 1, FJS_MAX_FAST_SCROLL);
+FUJITSU_SCROLL_PARAM_ATTR(palm, 0, FJS_MAX_CAPACITANCE);
+FUJITSU_SCROLL_PARAM_ATTR(yield, FJS_YIELD_NONE, FJS_YIELD_OFF);
+
+/*
+ * Learns a calibration table from the positions touched during the last
+ * capture.  On the
+ * Wheel, which gets turned all the way round, every part of the circle
+ * should see about as many packets, so the table spreads them evenly;
+ * it is blended with the identity so no part of the circle shrinks to
+ * less than a quarter of its size.  On the Sensor only the ends are
+ * learned, the range between them is stretched to the full one.
+ */
+static int fujitsu_scroll_cal_auto(struct fujitsu_scroll_data *priv, u16 *cal)
+{
+	u32 hist[FJS_CAL_BINS];
+	u64 total = 0, sum = 0;
+	int lo = -1, hi = -1;
+	int i, raw;
+
+	for (i = 0; i < FJS_CAL_BINS; i++) {
+		hist[i] = READ_ONCE(priv->cal_hist[i]);
+		total += hist[i];
+	}
+
+	if (total < FJS_CAL_MIN_SAMPLES)
+		return -ENODATA;
+
+	if (priv->type == FUJITSU_SCROLL_WHEEL) {
+		cal[0] = 0;
+		for (i = 0; i < FJS_CAL_BINS; i++) {
+			sum += hist[i];
+			raw = (i + 1) << FJS_CAL_BIN_SHIFT;
+			if (raw % FJS_CAL_STEP == 0)
+				cal[raw / FJS_CAL_STEP] =
+					(3 * div64_u64(sum * FJS_RANGE, total) +
+					 raw) / 4;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < FJS_CAL_BINS; i++) {
+		if (hist[i] > total >> FJS_CAL_NOISE_SHIFT) {
+			if (lo < 0)
+				lo = i << FJS_CAL_BIN_SHIFT;
+			hi = (i + 1) << FJS_CAL_BIN_SHIFT;
+		}
+	}
+
+	if (lo < 0)
+		return -ENODATA;
+
+	for (i = 0; i < FJS_CAL_KNOTS; i++)
+		cal[i] = clamp((i * FJS_CAL_STEP - lo) * FJS_RANGE / (hi - lo),
+			       0, FJS_RANGE);
 
 	return 0;
 }
 
-int fujitsu_scroll_init(struct psmouse *psmouse)
+static ssize_t fujitsu_scroll_show_calibration(struct psmouse *psmouse,
+					       void *data, char *buf)
 {
-	struct fujitsu_scroll_data *priv;
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	u16 cal[FJS_CAL_KNOTS];
+	int i, len = 0;
 
-	psmouse_reset(psmouse);
+	rcu_read_lock();
+	memcpy(cal, rcu_dereference(priv->settings)->cal, sizeof(cal));
+	rcu_read_unlock();
 
-	psmouse->private = priv = kzalloc(sizeof(struct fujitsu_scroll_data),
-					  GFP_KERNEL);
-	if (!priv)
+	for (i = 0; i < FJS_CAL_KNOTS; i++)
+		len += sprintf(buf + len, "%u%c", cal[i],
+			       i < FJS_CAL_KNOTS - 1 ? ' ' : '\n');
+
+	return len;
+}
+
+/*
+ * Takes "capture", "identity", "auto" or the FJS_CAL_KNOTS values of the
+ * table, which must not decrease.  The Wheel's has to start at 0 and end
+ * at FJS_RANGE, so it still wraps around where the raw position does.
+ * A capture counts the positions touched until the table is next set.
+ */
+static ssize_t fujitsu_scroll_set_calibration(struct psmouse *psmouse,
+					      void *data, const char *buf,
+					      size_t count)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_settings *new;
+	u16 cal[FJS_CAL_KNOTS];
+	unsigned int value;
+	int i, n, error;
+
+	if (sysfs_streq(buf, "capture")) {
+		new = fujitsu_scroll_dup_settings(priv);
+		if (!new)
+			return -ENOMEM;
+
+		memset(priv->cal_hist, 0, sizeof(priv->cal_hist));
+		new->cal_capture = 1;
+		fujitsu_scroll_publish(priv, new);
+		return count;
+	}
+
+	if (sysfs_streq(buf, "identity")) {
+		fujitsu_scroll_cal_identity(cal);
+	} else if (sysfs_streq(buf, "auto")) {
+		error = fujitsu_scroll_cal_auto(priv, cal);
+		if (error)
+			return error;
+	} else {
+		for (i = 0; i < FJS_CAL_KNOTS; i++) {
+			if (sscanf(buf, "%u%n", &value, &n) != 1 ||
+			    value > FJS_RANGE ||
+			    (i > 0 && value < cal[i - 1]))
+				return -EINVAL;
+
+			cal[i] = value;
+			buf += n;
+		}
+
+		if (priv->type == FUJITSU_SCROLL_WHEEL &&
+		    (cal[0] != 0 || cal[FJS_CAL_KNOTS - 1] != FJS_RANGE))
+			return -EINVAL;
+	}
+
+	new = fujitsu_scroll_dup_settings(priv);
+	if (!new)
 		return -ENOMEM;
 
-	psmouse->protocol_handler = fujitsu_scroll_process_byte;
-	psmouse->pktsize = FJS_PACKET_SIZE;
+	memcpy(new->cal, cal, sizeof(cal));
+	fujitsu_scroll_cal_identity(cal);
+	new->calibrated = memcmp(new->cal, cal, sizeof(cal)) != 0;
+	new->cal_capture = 0;
+	fujitsu_scroll_publish(priv, new);
 
-	psmouse->disconnect = fujitsu_scroll_disconnect;
-	psmouse->reconnect = fujitsu_scroll_reconnect;
-	psmouse->resync_time = 0;
+	return count;
+}
 
-	fujitsu_scroll_query_hardware(psmouse);
-	input_set_capability(psmouse->dev, EV_REL, priv->axis);
-	fujitsu_scroll_init_sequence(psmouse);
+__PSMOUSE_DEFINE_ATTR(calibration, S_IWUSR | S_IRUGO, NULL,
+		      fujitsu_scroll_show_calibration,
+		      fujitsu_scroll_set_calibration, false);
 
-	return 0;
+static ssize_t fujitsu_scroll_show_axis(struct psmouse *psmouse,
+					void *data, char *buf)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_action up, down;
+
+	rcu_read_lock();
+	up = rcu_dereference(priv->settings)->map[FJS_EVENT_UP];
+	down = rcu_dereference(priv->settings)->map[FJS_EVENT_DOWN];
+	rcu_read_unlock();
+
+	if (up.type != EV_REL || down.type != EV_REL || up.code != down.code)
+		return sprintf(buf, "mapped\n");
+
+	return sprintf(buf, "%s\n",
+		       up.code == REL_WHEEL ? "vertical" :
+		       up.code == REL_HWHEEL ? "horizontal" : "mapped");
+}
+
+static ssize_t fujitsu_scroll_set_axis(struct psmouse *psmouse, void *data,
+				       const char *buf, size_t count)
+{
+	struct fujitsu_scroll_action action = { .type = EV_REL };
+	int error;
+
+	if (sysfs_streq(buf, "vertical"))
+		action.code = REL_WHEEL;
+	else if (sysfs_streq(buf, "horizontal"))
+		action.code = REL_HWHEEL;
+	else
+		return -EINVAL;
+
+	error = fujitsu_scroll_update_map(psmouse,
+					  BIT(FJS_EVENT_UP) |
+						BIT(FJS_EVENT_DOWN),
+					  &action);
+
+	return error ?: count;
+}
+
+__PSMOUSE_DEFINE_ATTR(axis, S_IWUSR | S_IRUGO, NULL,
+		      fujitsu_scroll_show_axis, fujitsu_scroll_set_axis, false);
+
+/*
+ * map_up, map_down, map_press, map_double_tap and map_hold take
+ * "rel <code>", "key <code>" or "none", with codes as in
+ * linux/input-event-codes.h.
+ */
+static ssize_t fujitsu_scroll_show_map(struct psmouse *psmouse,
+				       void *data, char *buf)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	unsigned long event = (unsigned long)data;
+	struct fujitsu_scroll_action action;
+
+	rcu_read_lock();
+	action = rcu_dereference(priv->settings)->map[event];
+	rcu_read_unlock();
+
+	switch (action.type) {
+	case EV_REL:
+		return sprintf(buf, "rel %u\n", action.code);
+	case EV_KEY:
+		return sprintf(buf, "key %u\n", action.code);
+	default:
+		return sprintf(buf, "none\n");
+	}
+}
+
+static ssize_t fujitsu_scroll_set_map(struct psmouse *psmouse, void *data,
+				      const char *buf, size_t count)
+{
+	unsigned long event = (unsigned long)data;
+	struct fujitsu_scroll_action action = { 0 };
+	unsigned int code;
+	char type[4];
+	int error;
+
+	if (!sysfs_streq(buf, "none")) {
+		if (sscanf(buf, "%3s %u", type, &code) != 2)
+			return -EINVAL;
+
+		if (!strcmp(type, "rel") && code <= REL_MAX)
+			action.type = EV_REL;
+		else if (!strcmp(type, "key") && code &&
+			 code <= KEY_MAX)
+			action.type = EV_KEY;
+		else
+			return -EINVAL;
+
+		action.code = code;
+	}
+
+	error = fujitsu_scroll_update_map(psmouse, BIT(event), &action);
+
+	return error ?: count;
+}
+
+#define FUJITSU_SCROLL_MAP_ATTR(_name, _event)					\
+	__PSMOUSE_DEFINE_ATTR(_name, S_IWUSR | S_IRUGO, (void *)(_event),	\
+			      fujitsu_scroll_show_map,				\
+			      fujitsu_scroll_set_map, false)
+
+FUJITSU_SCROLL_MAP_ATTR(map_up, FJS_EVENT_UP);
+FUJITSU_SCROLL_MAP_ATTR(map_down, FJS_EVENT_DOWN);
+FUJITSU_SCROLL_MAP_ATTR(map_press, FJS_EVENT_PRESS);
+FUJITSU_SCROLL_MAP_ATTR(map_double_tap, FJS_EVENT_DOUBLE_TAP);
+FUJITSU_SCROLL_MAP_ATTR(map_hold, FJS_EVENT_HOLD);
+
+static const char * const fujitsu_scroll_op_modes[] = {
+	[FUJITSU_SCROLL_FULL]		= "full",
+	[FUJITSU_SCROLL_PRESS_ONLY]	= "press",
+	[FUJITSU_SCROLL_OFF]		= "off",
+};
+
+static ssize_t fujitsu_scroll_show_mode(struct psmouse *psmouse,
+					void *data, char *buf)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+
+	return sprintf(buf, "%s\n",
+		       fujitsu_scroll_op_modes[READ_ONCE(priv->op_mode)]);
+}
+
+/*
+ * psmouse has the device disabled while we are called, so the new mode
+ * byte can be sent right away if the device is currently open.
+ */
+static ssize_t fujitsu_scroll_set_mode(struct psmouse *psmouse, void *data,
+				       const char *buf, size_t count)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	int op_mode;
+
+	op_mode = sysfs_match_string(fujitsu_scroll_op_modes, buf);
+	if (op_mode < 0)
+		return op_mode;
+
+	mutex_lock(&priv->mode_mutex);
+
+	WRITE_ONCE(priv->op_mode, op_mode);
+	fujitsu_scroll_update_mode(psmouse);
+
+	mutex_unlock(&priv->mode_mutex);
+
+	return count;
+}
+
+PSMOUSE_DEFINE_ATTR(mode, S_IWUSR | S_IRUGO, NULL,
+		    fujitsu_scroll_show_mode, fujitsu_scroll_set_mode);
+
+static struct attribute *fujitsu_scroll_attrs[] = {
+	&psmouse_attr_mode.dattr.attr,
+	&psmouse_attr_threshold.dattr.attr,
+	&psmouse_attr_speed.dattr.attr,
+	&psmouse_attr_invert.dattr.attr,
+	&psmouse_attr_axis.dattr.attr,
+	&psmouse_attr_map_up.dattr.attr,
+	&psmouse_attr_map_down.dattr.attr,
+	&psmouse_attr_map_press.dattr.attr,
+	&psmouse_attr_map_double_tap.dattr.attr,
+	&psmouse_attr_map_hold.dattr.attr,
+	&psmouse_attr_filter.dattr.attr,
+	&psmouse_attr_accel.dattr.attr,
+	&psmouse_attr_storm_rate.dattr.attr,
+	&psmouse_attr_timestamp.dattr.attr,
+	&psmouse_attr_dpad.dattr.attr,
+	&psmouse_attr_dpad_buttons.dattr.attr,
+	&psmouse_attr_dpad_repeat.dattr.attr,
+	&psmouse_attr_slider.dattr.attr,
+	&psmouse_attr_continuous.dattr.attr,
+	&psmouse_attr_continuous_rate.dattr.attr,
+	&psmouse_attr_edge_zone.dattr.attr,
+	&psmouse_attr_gestures.dattr.attr,
+	&psmouse_attr_fast_scroll.dattr.attr,
+	&psmouse_attr_palm.dattr.attr,
+	&psmouse_attr_calibration.dattr.attr,
+	&psmouse_attr_yield.dattr.attr,
+	NULL
+};
+
+/* The D-pad attributes only exist on the Wheel, the slider on the Sensor */
+static umode_t fujitsu_scroll_attr_is_visible(struct kobject *kobj,
+					      struct attribute *attr, int n)
+{
+	struct serio *serio = to_serio_port(kobj_to_dev(kobj));
+	struct fujitsu_scroll_data *priv = psmouse_from_serio(serio)->private;
+
+	if (priv->type != FUJITSU_SCROLL_WHEEL &&
+	    (attr == &psmouse_attr_dpad.dattr.attr ||
+	     attr == &psmouse_attr_dpad_buttons.dattr.attr ||
+	     attr == &psmouse_attr_dpad_repeat.dattr.attr))
+		return 0;
+
+	if (priv->type != FUJITSU_SCROLL_SENSOR &&
+	    attr == &psmouse_attr_slider.dattr.attr)
+		return 0;
+
+	return attr->mode;
+}
+
+static const struct attribute_group fujitsu_scroll_attr_group = {
+	.attrs = fujitsu_scroll_attrs,
+	.is_visible = fujitsu_scroll_attr_is_visible,
+};
+
+/*****************************************************************************
+ *	Functions to interpret the packets
+ ****************************************************************************/
+
+static unsigned int
+fujitsu_scroll_linearize(const struct fujitsu_scroll_settings *s,
+			 unsigned int position)
+{
+	unsigned int knot = position >> FJS_CAL_SHIFT;
+	unsigned int frac = position & (FJS_CAL_STEP - 1);
+	const u16 *cal = s->cal;
+
+	return min_t(unsigned int, FJS_MAX_POS,
+		     cal[knot] +
+		     (((cal[knot + 1] - cal[knot]) * frac) >> FJS_CAL_SHIFT));
+}
+
+/*
+ * Returns the D-pad directions for a finger at the given position:
+ * one for each of the 4 main sectors, two for the diagonal ones when
+ * there are 8.
+ */
+static unsigned int
+fujitsu_scroll_dpad_dirs(struct fujitsu_scroll_data *priv,
+			 const struct fujitsu_scroll_settings *s,
+			 unsigned int position)
+{
+	unsigned int width = FJS_RANGE / s->dpad;
+	int sector = priv->dpad_sector;
+	int dist;
+
+	if (!priv->finger_down) {
+		priv->dpad_sector = -1;
+		return 0;
+	}
+
+	if (sector >= 0 && sector < s->dpad) {
+		dist = sign_extend32(position - sector * width, 11);
+		if (abs(dist) > width / 2 +
+				(width >> FJS_DPAD_HYSTERESIS_SHIFT))
+			sector = -1;
+	} else {
+		sector = -1;
+	}
+
+	if (sector < 0)
+		sector = ((position + width / 2) & FJS_MAX_POS) / width;
+
+	priv->dpad_sector = sector;
+
+	if (s->invert)
+		sector = (s->dpad - sector) % s->dpad;
+
+	if (s->dpad == FJS_DPAD_SECTORS)
+		return BIT(sector);
+
+	return BIT(sector / 2) |
+	       (sector & 1 ? BIT((sector / 2 + 1) % FJS_DPAD_SECTORS) : 0);
+}
+
+/*
+ * Returns the slider level for a finger at the given position, sticking
+ * to the current one while the finger is within its hysteresis margin.
+ */
+static int fujitsu_scroll_slider_level(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s,
+				       unsigned int position)
+{
+	unsigned int pos = s->invert ? position : FJS_MAX_POS - position;
+	unsigned int margin = FJS_RANGE / s->slider / 4;
+	int level = priv->slider_want;
+
+	if (level >= 0 && level < s->slider &&
+	    pos + margin >= level * FJS_RANGE / s->slider &&
+	    pos < (level + 1) * FJS_RANGE / s->slider + margin)
+		return level;
+
+	return pos * s->slider / FJS_RANGE;
+}
+
+/*
+ * Returns the continuous scrolling rate, in notches per second, for a
+ * finger at the given position; the sign is that of the notches
+ * movement in the same direction would produce.
+ */
+static int fujitsu_scroll_cont_rate(struct fujitsu_scroll_data *priv,
+				    const struct fujitsu_scroll_settings *s,
+				    unsigned int position)
+{
+	int offset, rate;
+
+	if (!priv->finger_down || !s->continuous)
+		return 0;
+
+	if (priv->type == FUJITSU_SCROLL_WHEEL) {
+		offset = sign_extend32(position - priv->anchor, 11);
+		if (abs(offset) <= FJS_SHUTTLE_DEAD)
+			return 0;
+
+		rate = DIV_ROUND_UP(s->continuous_rate *
+				    (min(abs(offset), FJS_SHUTTLE_RANGE) -
+				     FJS_SHUTTLE_DEAD),
+				    FJS_SHUTTLE_RANGE - FJS_SHUTTLE_DEAD);
+	} else if (position < s->edge_zone) {
+		offset = -1;
+		rate = s->continuous_rate;
+	} else if (position > FJS_MAX_POS - s->edge_zone) {
+		offset = 1;
+		rate = s->continuous_rate;
+	} else {
+		return 0;
+	}
+
+	return (offset < 0) == !s->invert ? rate : -rate;
+}
+
+/*
+ * Returns the movement of the Wheel since the last packet.  The position
+ * wraps around, so a change could have gone either way round; the one
+ * closer to where the recent angular velocity would have taken the finger
+ * wins, which keeps fast spins and gaps left by lost packets from
+ * reversing.  Changes no finger could have made in the time since the
+ * last packet are dropped.
+ */
+static int fujitsu_scroll_unwrap(struct fujitsu_scroll_data *priv,
+				 unsigned int position, ktime_t time)
+{
+	s64 elapsed = ktime_us_delta(time, priv->last_event_time);
+	int delta = sign_extend32(position - priv->last_event_position, 11);
+	int predicted, limit;
+	s64 velocity;
+
+	priv->last_event_time = time;
+
+	if (elapsed > FJS_VELOCITY_WINDOW * USEC_PER_MSEC) {
+		elapsed = FJS_VELOCITY_WINDOW * USEC_PER_MSEC;
+		priv->velocity = 0;
+	} else if (elapsed <= 0) {
+		elapsed = 1;
+	}
+
+	predicted = div_s64((s64)priv->velocity * elapsed,
+			    USEC_PER_MSEC) >> FJS_VELOCITY_SHIFT;
+
+	if (abs(delta + FJS_RANGE - predicted) < abs(delta - predicted)) {
+		delta += FJS_RANGE;
+		priv->stats.unwrapped++;
+	} else if (abs(delta - FJS_RANGE - predicted) <
+		   abs(delta - predicted)) {
+		delta -= FJS_RANGE;
+		priv->stats.unwrapped++;
+	}
+
+	limit = div_s64(FJS_MAX_SPIN * elapsed, USEC_PER_MSEC) +
+		FJS_SPIN_SLACK;
+	if (abs(delta) > limit) {
+		priv->velocity = 0;
+		priv->stats.implausible++;
+		return 0;
+	}
+
+	/* Half of the old velocity, half of the new */
+	velocity = div_s64((s64)delta * USEC_PER_MSEC *
+				(1 << FJS_VELOCITY_SHIFT), elapsed);
+	velocity = clamp_t(s64, velocity,
+			   -(FJS_MAX_SPIN << FJS_VELOCITY_SHIFT),
+			   FJS_MAX_SPIN << FJS_VELOCITY_SHIFT);
+	priv->velocity = (priv->velocity + (int)velocity) / 2;
+
+	return delta;
+}
+
+/*
+ * Returns how far the finger moved since the last packet: the short way
+ * round on the Wheel, whose position wraps around, straight across on
+ * the Sensor.
+ */
+static unsigned int fujitsu_scroll_jump(struct fujitsu_scroll_data *priv,
+					unsigned int position)
+{
+	if (priv->type == FUJITSU_SCROLL_WHEEL)
+		return abs(sign_extend32(position - priv->last_event_position,
+					 11));
+
+	return abs((int)position - (int)priv->last_event_position);
+}
+
+/*
+ * Tracks a second finger on the device from the capacitance jump it
+ * causes while the position stays put.
+ */
+static void fujitsu_scroll_two_fingers(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s,
+				       unsigned int capacitance,
+				       unsigned int position)
+{
+	if (!priv->finger_down || capacitance < s->threshold) {
+		priv->two_fingers = false;
+	} else if (!priv->two_fingers) {
+		if (capacitance >= priv->capacitance + FJS_TWO_FINGER_JUMP &&
+		    fujitsu_scroll_jump(priv, position) <
+				FJS_TWO_FINGER_STILL) {
+			priv->two_fingers = true;
+			priv->one_finger = priv->capacitance;
+			priv->stats.two_fingers++;
+		}
+	} else if (capacitance < priv->one_finger + FJS_TWO_FINGER_JUMP / 2) {
+		priv->two_fingers = false;
+	}
+}
+
+/*
+ * Scores a packet of a touch and returns whether the touch has been
+ * classified as a palm.  A finger resting on the device for long enough
+ * at palm level is rejected too, which is what a palm looks like once
+ * it has settled.
+ */
+static bool fujitsu_scroll_palm(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				unsigned int capacitance, unsigned int position,
+				ktime_t time)
+{
+	int rise = capacitance - priv->capacitance;
+	s64 elapsed = ktime_us_delta(time, priv->last_time);
+
+	priv->last_time = time;
+
+	if (capacitance < s->threshold) {
+		priv->palm_score = 0;
+		priv->palm = false;
+		return false;
+	}
+
+	priv->palm_score -= priv->palm_score >> FJS_PALM_DECAY_SHIFT;
+
+	if (capacitance >= s->palm)
+		priv->palm_score += FJS_PALM_ONE;
+
+	if (rise > 0 && elapsed > 0 &&
+	    elapsed <= FJS_PALM_RISE_WINDOW * USEC_PER_MSEC &&
+	    rise * 10 * USEC_PER_MSEC >= FJS_PALM_RISE * elapsed)
+		priv->palm_score += FJS_PALM_ONE;
+
+	if (priv->finger_down &&
+	    fujitsu_scroll_jump(priv, position) > FJS_PALM_JUMP)
+		priv->palm_score += FJS_PALM_ONE;
+
+	if (!priv->palm && priv->palm_score >= FJS_PALM_REJECT) {
+		priv->palm = true;
+		priv->movement = 0;
+		priv->stats.palms++;
+	}
+
+	return priv->palm;
+}
+
+/*
+ * Frames of the two devices sharing an input device must not interleave,
+ * and neither may those of a device and its own repeat timer.
+ */
+static spinlock_t *fujitsu_scroll_frame_lock(struct fujitsu_scroll_data *priv)
+{
+	return priv->shared ? &priv->shared->lock : &priv->frame_lock;
+}
+
+/*
+ * The timer is only ever started here, when it is not running; while it
+ * runs it picks up rate changes on its next tick and stops by itself
+ * once the rate drops to 0 or the device falls silent.
+ */
+static void fujitsu_scroll_cont_update(struct fujitsu_scroll_data *priv,
+				       int rate)
+{
+	spinlock_t *lock = fujitsu_scroll_frame_lock(priv);
+	unsigned long flags;
+
+	if (!rate && !READ_ONCE(priv->cont_rate))
+		return;
+
+	spin_lock_irqsave(lock, flags);
+
+	WRITE_ONCE(priv->cont_rate, rate);
+	if (rate && !priv->cont_running) {
+		priv->cont_running = true;
+		hrtimer_start(&priv->cont_timer,
+			      ns_to_ktime(NSEC_PER_SEC / abs(rate)),
+			      HRTIMER_MODE_REL);
+	}
+
+	spin_unlock_irqrestore(lock, flags);
+}
+
+/*
+ * Decoding stages.  Decoding, touch tracking, motion and notches are
+ * what every packet goes through and are called directly.
+ * Which optional stages run before touch tracking and which transform
+ * the movement is worked out whenever the settings change (see
+ * fujitsu_scroll_build_stages()), so features that are switched off
+ * cost nothing per packet.
+ */
+static bool fujitsu_scroll_stage_decode(struct fujitsu_scroll_data *priv,
+					const struct fujitsu_scroll_settings *s,
+					struct fujitsu_scroll_sample *smp)
+{
+	smp->position = ((smp->packet[1] & 0x0f) << 8) + smp->packet[2];
+	smp->capacitance = smp->packet[0] & 0x3f;
+	return true;
+}
+
+/* Counts the raw positions touched, for a calibration to be learned */
+static bool fujitsu_scroll_stage_capture(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				struct fujitsu_scroll_sample *smp)
+{
+	if (smp->capacitance >= s->threshold)
+		priv->cal_hist[smp->position >> FJS_CAL_BIN_SHIFT]++;
+	return true;
+}
+
+static bool fujitsu_scroll_stage_linearize(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				struct fujitsu_scroll_sample *smp)
+{
+	smp->position = fujitsu_scroll_linearize(s, smp->position);
+	return true;
+}
+
+static bool fujitsu_scroll_stage_dpad(struct fujitsu_scroll_data *priv,
+				      const struct fujitsu_scroll_settings *s,
+				      struct fujitsu_scroll_sample *smp)
+{
+	priv->finger_down = smp->capacitance >= s->threshold;
+	priv->last_event_position = smp->position;
+	priv->dpad_want = fujitsu_scroll_dpad_dirs(priv, s, smp->position);
+	return false;
+}
+
+static bool fujitsu_scroll_stage_slider(struct fujitsu_scroll_data *priv,
+					const struct fujitsu_scroll_settings *s,
+					struct fujitsu_scroll_sample *smp)
+{
+	priv->finger_down = smp->capacitance >= s->threshold;
+	priv->last_event_position = smp->position;
+	if (priv->finger_down)
+		priv->slider_want =
+			fujitsu_scroll_slider_level(priv, s, smp->position);
+	return false;
+}
+
+/* A palm is tracked, but scrolls nothing */
+static bool fujitsu_scroll_stage_palm(struct fujitsu_scroll_data *priv,
+				      const struct fujitsu_scroll_settings *s,
+				      struct fujitsu_scroll_sample *smp)
+{
+	if (!fujitsu_scroll_palm(priv, s, smp->capacitance, smp->position,
+				 smp->time))
+		return true;
+
+	priv->finger_down = 1;
+	priv->last_event_position = smp->position;
+	priv->capacitance = smp->capacitance;
+	priv->two_fingers = false;
+	priv->stats.palm_packets++;
+	return false;
+}
+
+static bool fujitsu_scroll_stage_fingers(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				struct fujitsu_scroll_sample *smp)
+{
+	fujitsu_scroll_two_fingers(priv, s, smp->capacitance, smp->position);
+	return true;
+}
+
+/*
+ * Tracks the finger going down and up.  Only packets continuing a touch
+ * move anything, and with the jog shuttle not even those.
+ */
+static bool fujitsu_scroll_stage_touch(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s,
+				       struct fujitsu_scroll_sample *smp)
+{
+	unsigned int position = smp->position;
+	bool moving = false;
+
+	priv->capacitance = smp->capacitance;
+
+	if (smp->capacitance >= s->threshold) {
+		if (!priv->finger_down) {
+			priv->finger_down = 1;
+			priv->last_event_position = position;
+			priv->last_event_time = smp->time;
+			priv->velocity = 0;
+			priv->anchor = position;
+			priv->smoothed = 0;
+		} else if (priv->type == FUJITSU_SCROLL_WHEEL &&
+			   s->continuous) {
+			/* Jog shuttle: only the offset from anchor counts */
+			priv->last_event_position = position;
+		} else {
+			moving = true;
+		}
+	} else if (priv->finger_down == 1) {
+		priv->finger_down = 0;
+	}
+
+	smp->cont_rate = fujitsu_scroll_cont_rate(priv, s, position);
+
+	return moving;
+}
+
+static bool fujitsu_scroll_stage_wheel(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s,
+				       struct fujitsu_scroll_sample *smp)
+{
+	smp->movement = fujitsu_scroll_unwrap(priv, smp->position, smp->time);
+	priv->last_event_position = smp->position;
+	return true;
+}
+
+static bool fujitsu_scroll_stage_sensor(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				struct fujitsu_scroll_sample *smp)
+{
+	smp->movement = smp->position - priv->last_event_position;
+	priv->last_event_position = smp->position;
+	return true;
+}
+
+static bool fujitsu_scroll_stage_filter(struct fujitsu_scroll_data *priv,
+					const struct fujitsu_scroll_settings *s,
+					struct fujitsu_scroll_sample *smp)
+{
+	/*
+	 * smoothed is the average scaled by 2^filter.  What decays out of
+	 * it is what gets reported, so fractions stay in smoothed and carry
+	 * over to later packets instead of being truncated away.  It is
+	 * rounded to nearest the same way for both signs; a shift would
+	 * round down, leaving less behind going up than going down.
+	 */
+	priv->smoothed += smp->movement;
+	smp->movement = DIV_ROUND_CLOSEST(priv->smoothed, 1 << s->filter);
+	priv->smoothed -= smp->movement;
+	return true;
+}
+
+/*
+ * A movement is at most FJS_RANGE, but its square times accel is not
+ * far from overflowing an int, so the square is taken in 64 bits.
+ */
+static bool fujitsu_scroll_stage_accel(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s,
+				       struct fujitsu_scroll_sample *smp)
+{
+	s64 movement = clamp(smp->movement, -FJS_RANGE, FJS_RANGE);
+
+	smp->movement = movement +
+			div_s64(movement * abs(movement) * s->accel,
+				1 << FJS_ACCEL_SHIFT);
+	return true;
+}
+
+/* Last, so that two fingers scale the accelerated movement */
+static bool fujitsu_scroll_stage_fast(struct fujitsu_scroll_data *priv,
+				      const struct fujitsu_scroll_settings *s,
+				      struct fujitsu_scroll_sample *smp)
+{
+	if (priv->two_fingers)
+		smp->movement *= (int)s->fast_scroll;
+	return true;
+}
+
+/* Turns the accumulated movement into whole notches */
+static bool fujitsu_scroll_stage_notches(struct fujitsu_scroll_data *priv,
+				const struct fujitsu_scroll_settings *s,
+				struct fujitsu_scroll_sample *smp)
+{
+	unsigned int distance;
+	int roll;
+
+	priv->movement += smp->movement;
+
+	distance = reciprocal_divide(abs(priv->movement), s->speed_recip);
+	roll = priv->movement < 0 ? -(int)distance : distance;
+	priv->movement -= roll * (int)s->speed;
+
+	smp->roll = s->invert ? roll : -roll;
+	return true;
+}
+
+static void fujitsu_scroll_add_stage(fujitsu_scroll_stage_fn *stages,
+				     unsigned int *num,
+				     fujitsu_scroll_stage_fn stage)
+{
+	if (!WARN_ON_ONCE(*num >= FJS_MAX_STAGES))
+		stages[(*num)++] = stage;
+}
+
+/*
+ * The D-pad and the slider replace scrolling altogether, so they are
+ * the last stage to run.  With the jog shuttle, touch tracking stops
+ * every packet by itself.
+ */
+static void fujitsu_scroll_build_stages(struct fujitsu_scroll_data *priv,
+					struct fujitsu_scroll_settings *s)
+{
+	bool wheel = priv->type == FUJITSU_SCROLL_WHEEL;
+
+	/* Capture, linearize and two more before touch tracking */
+	BUILD_BUG_ON(FJS_MAX_STAGES < 4);
+
+	s->num_stages = s->num_transforms = 0;
+
+	if (s->cal_capture)
+		fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+					 fujitsu_scroll_stage_capture);
+	if (s->calibrated)
+		fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+					 fujitsu_scroll_stage_linearize);
+
+	if (wheel && s->dpad) {
+		fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+					 fujitsu_scroll_stage_dpad);
+	} else if (!wheel && s->slider) {
+		fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+					 fujitsu_scroll_stage_slider);
+	} else {
+		if (s->palm)
+			fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+						 fujitsu_scroll_stage_palm);
+		if (s->gestures)
+			fujitsu_scroll_add_stage(s->stages, &s->num_stages,
+						 fujitsu_scroll_stage_fingers);
+	}
+
+	/* Without the D-pad stage, the next packet lets go of its keys */
+	if (!wheel || !s->dpad)
+		WRITE_ONCE(priv->dpad_want, 0);
+
+	if (s->filter)
+		fujitsu_scroll_add_stage(s->transforms, &s->num_transforms,
+					 fujitsu_scroll_stage_filter);
+	if (s->accel)
+		fujitsu_scroll_add_stage(s->transforms, &s->num_transforms,
+					 fujitsu_scroll_stage_accel);
+	if (s->gestures)
+		fujitsu_scroll_add_stage(s->transforms, &s->num_transforms,
+					 fujitsu_scroll_stage_fast);
+	else
+		WRITE_ONCE(priv->two_fingers, false);	/* nothing clears it */
+}
+
+static bool fujitsu_scroll_run_stages(struct fujitsu_scroll_data *priv,
+				      const struct fujitsu_scroll_settings *s,
+				      struct fujitsu_scroll_sample *smp,
+				      const fujitsu_scroll_stage_fn *stages,
+				      unsigned int num)
+{
+	unsigned int i;
+
+	for (i = 0; i < num; i++)
+		if (!stages[i](priv, s, smp))
+			return false;
+
+	return true;
+}
+
+/*
+ * Runs one packet, received at time, through the decoding stages and
+ * returns the scroll notches it produced.  Reporting them is the last
+ * stage, left to the caller so that a storm batch can be merged.
+ */
+static int fujitsu_scroll_decode(struct fujitsu_scroll_data *priv,
+				 const struct fujitsu_scroll_settings *s,
+				 const u8 *packet, ktime_t time)
+{
+	struct fujitsu_scroll_sample smp = {
+		.packet = packet,
+		.time = time,
+	};
+
+	fujitsu_scroll_stage_decode(priv, s, &smp);
+
+	if (fujitsu_scroll_run_stages(priv, s, &smp,
+				      s->stages, s->num_stages) &&
+	    fujitsu_scroll_stage_touch(priv, s, &smp)) {
+		if (priv->type == FUJITSU_SCROLL_WHEEL)
+			fujitsu_scroll_stage_wheel(priv, s, &smp);
+		else
+			fujitsu_scroll_stage_sensor(priv, s, &smp);
+
+		if (fujitsu_scroll_run_stages(priv, s, &smp, s->transforms,
+					      s->num_transforms))
+			fujitsu_scroll_stage_notches(priv, s, &smp);
+	}
+
+	fujitsu_scroll_cont_update(priv, smp.cont_rate);
+
+	return smp.roll;
+}
+
+/* Called with the frame lock held */
+static void fujitsu_scroll_report_dpad(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s)
+{
+	struct input_dev *dev = priv->dev;
+	unsigned long changed = priv->dpad_want ^ priv->dpad_down;
+	const unsigned short *keys;
+	int i;
+
+	/* Keys are released as they were pressed, even if remapped since */
+	if (!priv->dpad_down)
+		priv->dpad_keyset = s->dpad_buttons;
+	keys = fujitsu_scroll_dpad_keys[priv->dpad_keyset];
+
+	for_each_set_bit(i, &changed, FJS_DPAD_SECTORS)
+		input_report_key(dev, keys[i], priv->dpad_want & BIT(i));
+
+	priv->dpad_down = priv->dpad_want;
+	priv->dpad_changed = ktime_get();
+
+	/* A running timer holds the new directions back by itself */
+	if (priv->dpad_down && s->dpad_repeat && !priv->dpad_running) {
+		priv->dpad_running = true;
+		hrtimer_start(&priv->dpad_timer,
+			      ms_to_ktime(FJS_DPAD_REPEAT_DELAY),
+			      HRTIMER_MODE_REL);
+	}
+}
+
+/* Lets go of all directions; called with the frame lock held */
+static void fujitsu_scroll_release_dpad(struct fujitsu_scroll_data *priv)
+{
+	unsigned long down = priv->dpad_down;
+	const unsigned short *keys;
+	int i;
+
+	priv->dpad_want = priv->dpad_down = 0;
+	if (!down)
+		return;
+
+	keys = fujitsu_scroll_dpad_keys[priv->dpad_keyset];
+	for_each_set_bit(i, &down, FJS_DPAD_SECTORS)
+		input_report_key(priv->dev, keys[i], 0);
+	input_sync(priv->dev);
+}
+
+static bool fujitsu_scroll_silent(struct fujitsu_scroll_data *priv,
+				  ktime_t now)
+{
+	return ktime_ms_delta(now, READ_ONCE(priv->psmouse->last_packet)) >
+		FJS_SILENCE_TIMEOUT;
+}
+
+static enum hrtimer_restart fujitsu_scroll_dpad_repeat(struct hrtimer *timer)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(timer, struct fujitsu_scroll_data, dpad_timer);
+	spinlock_t *lock = fujitsu_scroll_frame_lock(priv);
+	struct input_dev *dev = priv->dev;
+	const unsigned short *keys;
+	ktime_t now = ktime_get();
+	unsigned long down, flags;
+	unsigned int period;
+	ktime_t next;
+	int i;
+
+	rcu_read_lock();
+	period = rcu_dereference(priv->settings)->dpad_repeat;
+	rcu_read_unlock();
+
+	spin_lock_irqsave(lock, flags);
+
+	/* No packets, no finger: don't keep a direction held forever */
+	if (priv->dpad_down && fujitsu_scroll_silent(priv, now))
+		fujitsu_scroll_release_dpad(priv);
+
+	down = priv->dpad_down;
+	if (!down || !period) {
+		priv->dpad_running = false;
+		spin_unlock_irqrestore(lock, flags);
+		return HRTIMER_NORESTART;
+	}
+
+	/* Directions that changed since the last tick wait the delay out */
+	next = ktime_add_ms(priv->dpad_changed, FJS_DPAD_REPEAT_DELAY);
+	if (ktime_before(now, next)) {
+		spin_unlock_irqrestore(lock, flags);
+		hrtimer_set_expires(timer, next);
+		return HRTIMER_RESTART;
+	}
+
+	keys = fujitsu_scroll_dpad_keys[priv->dpad_keyset];
+	for_each_set_bit(i, &down, FJS_DPAD_SECTORS)
+		input_event(dev, EV_KEY, keys[i], 2);
+	input_sync(dev);
+
+	spin_unlock_irqrestore(lock, flags);
+
+	hrtimer_forward_now(timer, ms_to_ktime(period));
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Notches mapped to a key are reported as one click each, all but the
+ * last in frames of their own.
+ */
+static void fujitsu_scroll_report_roll(struct input_dev *dev,
+				       const struct fujitsu_scroll_settings *s,
+				       int roll, ktime_t time)
+{
+	const struct fujitsu_scroll_action *action;
+	int clicks;
+
+	action = &s->map[roll > 0 ? FJS_EVENT_UP : FJS_EVENT_DOWN];
+
+	switch (action->type) {
+	case EV_REL:
+		input_report_rel(dev, action->code, roll);
+		break;
+
+	case EV_KEY:
+		for (clicks = abs(roll); clicks > 0; clicks--) {
+			input_report_key(dev, action->code, 1);
+			input_set_timestamp(dev, time);
+			input_sync(dev);
+			input_report_key(dev, action->code, 0);
+			if (clicks > 1) {
+				input_set_timestamp(dev, time);
+				input_sync(dev);
+			}
+		}
+		break;
+	}
+}
+
+static enum hrtimer_restart fujitsu_scroll_cont_tick(struct hrtimer *timer)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(timer, struct fujitsu_scroll_data, cont_timer);
+	spinlock_t *lock = fujitsu_scroll_frame_lock(priv);
+	struct input_dev *dev = priv->dev;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+	int rate;
+
+	rcu_read_lock();
+	spin_lock_irqsave(lock, flags);
+
+	/* No packets means no finger to keep the scrolling going */
+	if (fujitsu_scroll_silent(priv, now))
+		WRITE_ONCE(priv->cont_rate, 0);
+
+	rate = priv->cont_rate;
+	if (!rate) {
+		priv->cont_running = false;
+		spin_unlock_irqrestore(lock, flags);
+		rcu_read_unlock();
+		return HRTIMER_NORESTART;
+	}
+
+	fujitsu_scroll_report_roll(dev, rcu_dereference(priv->settings),
+				   rate > 0 ? 1 : -1, now);
+	input_set_timestamp(dev, now);
+	input_sync(dev);
+	priv->stats.frames++;
+
+	spin_unlock_irqrestore(lock, flags);
+	rcu_read_unlock();
+
+	hrtimer_forward_now(timer, ns_to_ktime(NSEC_PER_SEC / abs(rate)));
+	return HRTIMER_RESTART;
+}
+
+/* EV_REL actions only go down, by one notch */
+static void fujitsu_scroll_report_action(struct input_dev *dev,
+					 const struct fujitsu_scroll_action *a,
+					 bool down)
+{
+	if (a->type == EV_KEY)
+		input_report_key(dev, a->code, down);
+	else if (a->type == EV_REL && down)
+		input_report_rel(dev, a->code, 1);
+}
+
+/*
+ * Lets go of the press region, and of the key it holds down, if any:
+ * that of a hold, or of a press outside of gestures.  Called with the
+ * frame lock held.
+ */
+static void fujitsu_scroll_release_press(struct fujitsu_scroll_data *priv)
+{
+	bool down = priv->gesture == FJS_GESTURE_HELD ||
+		    (priv->pressed && priv->gesture == FJS_GESTURE_IDLE);
+
+	priv->pressed = false;
+	priv->gesture = FJS_GESTURE_IDLE;
+	if (!down)
+		return;
+
+	fujitsu_scroll_report_action(priv->dev, &priv->press_action, false);
+	input_sync(priv->dev);
+}
+
+/*
+ * Forgets the touch in progress when the device is closed, reconfigured,
+ * reconnected or disconnected: packets may stop or change meaning, so
+ * nothing of the touch may keep scrolling or keep a key held.
+ */
+static void fujitsu_scroll_reset_touch(struct fujitsu_scroll_data *priv)
+{
+	struct serio *serio = priv->psmouse->ps2dev.serio;
+	spinlock_t *lock = fujitsu_scroll_frame_lock(priv);
+	unsigned long flags;
+
+	/*
+	 * Packets a storm deferred belong to the touch being forgotten and
+	 * would start it again.  The work item is kept off while they are
+	 * dropped; nothing can queue it again before rx continues.
+	 */
+	disable_work_sync(&priv->storm_work);
+	serio_pause_rx(serio);
+	kfifo_reset(&priv->storm_fifo);
+	enable_work(&priv->storm_work);
+	spin_lock_irqsave(lock, flags);
+
+	priv->finger_down = 0;
+	WRITE_ONCE(priv->cont_rate, 0);
+	fujitsu_scroll_release_dpad(priv);
+	fujitsu_scroll_release_press(priv);
+
+	spin_unlock_irqrestore(lock, flags);
+	serio_continue_rx(serio);
+
+	hrtimer_cancel(&priv->cont_timer);
+	hrtimer_cancel(&priv->dpad_timer);
+	hrtimer_cancel(&priv->gesture_timer);
+
+	/*
+	 * A packet that came in meanwhile saw the timers as running and
+	 * left them alone; the next one that needs a timer starts it.  A
+	 * gesture it started gets its timeout back.
+	 */
+	spin_lock_irqsave(lock, flags);
+	priv->cont_running = false;
+	priv->dpad_running = false;
+	if (priv->gesture != FJS_GESTURE_IDLE)
+		hrtimer_start(&priv->gesture_timer, priv->gesture_deadline,
+			      HRTIMER_MODE_ABS);
+	spin_unlock_irqrestore(lock, flags);
+}
+
+/* Clicks an action, each time in frames of its own */
+static void fujitsu_scroll_click(struct input_dev *dev,
+				 const struct fujitsu_scroll_action *a,
+				 int clicks, ktime_t time)
+{
+	while (clicks--) {
+		fujitsu_scroll_report_action(dev, a, true);
+		input_set_timestamp(dev, time);
+		input_sync(dev);
+		fujitsu_scroll_report_action(dev, a, false);
+		input_set_timestamp(dev, time);
+		input_sync(dev);
+	}
+}
+
+static void fujitsu_scroll_gesture_arm(struct fujitsu_scroll_data *priv,
+				       ktime_t deadline)
+{
+	priv->gesture_deadline = deadline;
+	hrtimer_start(&priv->gesture_timer, deadline, HRTIMER_MODE_ABS);
+}
+
+/*
+ * Steps the gesture state machine on a change of the press region.
+ * Called with the frame lock held, timeouts are handled by
+ * fujitsu_scroll_gesture_timeout().
+ */
+static void fujitsu_scroll_gesture(struct fujitsu_scroll_data *priv,
+				   const struct fujitsu_scroll_settings *s,
+				   bool pressed, ktime_t time)
+{
+	struct input_dev *dev = priv->dev;
+	bool bounce = ktime_ms_delta(time, priv->gesture_start) <
+			FJS_TAP_DEBOUNCE;
+	ktime_t hold = ktime_add_ms(time, FJS_HOLD_TIME);
+	ktime_t again = ktime_add_ms(time, FJS_DOUBLE_TAP_TIME);
+
+	switch (priv->gesture) {
+	case FJS_GESTURE_IDLE:
+		if (pressed) {
+			priv->gesture_start = time;
+			priv->gesture = FJS_GESTURE_PRESSED;
+			fujitsu_scroll_gesture_arm(priv, hold);
+		} else {
+			/* Pressed before gestures were enabled */
+			fujitsu_scroll_report_action(dev, &priv->press_action,
+						     false);
+		}
+		break;
+
+	case FJS_GESTURE_PRESSED:
+		if (bounce) {
+			priv->gesture = FJS_GESTURE_IDLE;
+			hrtimer_try_to_cancel(&priv->gesture_timer);
+		} else {
+			priv->gesture = FJS_GESTURE_TAPPED;
+			fujitsu_scroll_gesture_arm(priv, again);
+		}
+		break;
+
+	case FJS_GESTURE_HELD:
+		fujitsu_scroll_report_action(dev, &priv->press_action, false);
+		priv->gesture = FJS_GESTURE_IDLE;
+		break;
+
+	case FJS_GESTURE_TAPPED:
+		priv->gesture_start = time;
+		priv->gesture = FJS_GESTURE_PRESSED_AGAIN;
+		hrtimer_try_to_cancel(&priv->gesture_timer);
+		break;
+
+	case FJS_GESTURE_PRESSED_AGAIN:
+		priv->gesture = FJS_GESTURE_IDLE;
+		if (bounce) {
+			fujitsu_scroll_click(dev, &s->map[FJS_EVENT_PRESS], 1,
+					     time);
+			priv->stats.taps++;
+		} else if (s->map[FJS_EVENT_DOUBLE_TAP].type) {
+			fujitsu_scroll_click(dev, &s->map[FJS_EVENT_DOUBLE_TAP],
+					     1, time);
+			priv->stats.double_taps++;
+		} else {
+			fujitsu_scroll_click(dev, &s->map[FJS_EVENT_PRESS], 2,
+					     time);
+			priv->stats.double_taps++;
+		}
+		break;
+	}
+}
+
+/*
+ * A touch that outlived FJS_HOLD_TIME becomes a hold, a tap not followed
+ * by another within FJS_DOUBLE_TAP_TIME a single one.  The state may have
+ * moved on, and the timer been re-armed, while we waited for the lock.
+ */
+static enum hrtimer_restart
+fujitsu_scroll_gesture_timeout(struct hrtimer *timer)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(timer, struct fujitsu_scroll_data, gesture_timer);
+	struct input_dev *dev = priv->dev;
+	const struct fujitsu_scroll_settings *s;
+	ktime_t now = ktime_get();
+	unsigned long flags;
+
+	rcu_read_lock();
+	s = rcu_dereference(priv->settings);
+	spin_lock_irqsave(fujitsu_scroll_frame_lock(priv), flags);
+
+	if (ktime_before(now, priv->gesture_deadline))
+		goto out;
+
+	switch (priv->gesture) {
+	case FJS_GESTURE_PRESSED:
+		priv->press_action = s->map[FJS_EVENT_HOLD].type ?
+					s->map[FJS_EVENT_HOLD] :
+					s->map[FJS_EVENT_PRESS];
+		fujitsu_scroll_report_action(dev, &priv->press_action, true);
+		input_set_timestamp(dev, now);
+		input_sync(dev);
+		priv->gesture = FJS_GESTURE_HELD;
+		priv->stats.holds++;
+		break;
+
+	case FJS_GESTURE_TAPPED:
+		fujitsu_scroll_click(dev, &s->map[FJS_EVENT_PRESS], 1, now);
+		priv->gesture = FJS_GESTURE_IDLE;
+		priv->stats.taps++;
+		break;
+
+	default:
+		break;
+	}
+
+out:
+	spin_unlock_irqrestore(fujitsu_scroll_frame_lock(priv), flags);
+	rcu_read_unlock();
+
+	return HRTIMER_NORESTART;
+}
+
+/*
+ * Whether a packet changed anything besides scrolling: the press
+ * region, the D-pad directions or the slider level.
+ */
+static bool fujitsu_scroll_state_changed(struct fujitsu_scroll_data *priv,
+					 bool pressed)
+{
+	return pressed != priv->pressed ||
+	       priv->dpad_want != priv->dpad_down ||
+	       priv->slider_want != priv->slider_level;
+}
+
+/*
+ * Reports whatever changed and closes the frame.  Packets that do not
+ * change anything (finger resting, movement short of a notch) emit
+ * nothing at all, their movement carries over to the next packet.
+ * The frame is stamped with the arrival time of the (last) packet it
+ * was decoded from rather than the time it is reported at.
+ */
+static void fujitsu_scroll_report(struct psmouse *psmouse,
+				  const struct fujitsu_scroll_settings *s,
+				  int roll, bool pressed, ktime_t time)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct input_dev *dev = priv->dev;
+	unsigned long flags;
+
+	if (roll == 0 && !fujitsu_scroll_state_changed(priv, pressed)) {
+		priv->stats.syncs_skipped++;
+		return;
+	}
+
+	spin_lock_irqsave(fujitsu_scroll_frame_lock(priv), flags);
+
+	if (priv->dpad_want != priv->dpad_down)
+		fujitsu_scroll_report_dpad(priv, s);
+
+	if (priv->slider_want != priv->slider_level) {
+		input_report_abs(dev, FJS_SLIDER_AXIS,
+				 priv->slider_want *
+					(FJS_MAX_SLIDER_LEVELS - 1) /
+					(s->slider - 1));
+		priv->slider_level = priv->slider_want;
+	}
+
+	if (roll != 0)
+		fujitsu_scroll_report_roll(dev, s, roll, time);
+
+	if (pressed != priv->pressed && s->gestures) {
+		fujitsu_scroll_gesture(priv, s, pressed, time);
+		priv->pressed = pressed;
+	} else if (pressed != priv->pressed) {
+		/* Release whatever was pressed, even if remapped since */
+		if (pressed)
+			priv->press_action = s->map[FJS_EVENT_PRESS];
+
+		fujitsu_scroll_report_action(dev, &priv->press_action,
+					     pressed);
+		priv->gesture = FJS_GESTURE_IDLE;
+		priv->pressed = pressed;
+	}
+
+	if (s->timestamp)
+		input_event(dev, EV_MSC, MSC_TIMESTAMP,
+			    (u32)ktime_to_us(time));
+
+	input_set_timestamp(dev, time);
+	input_sync(dev);
+
+	spin_unlock_irqrestore(fujitsu_scroll_frame_lock(priv), flags);
+
+	priv->stats.frames++;
+}
+
+/*
+ *  called for each full received packet from the device
+ */
+static void
+fujitsu_scroll_process_packet(struct psmouse *psmouse,
+			      const struct fujitsu_scroll_settings *s)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	int roll;
+
+	roll = fujitsu_scroll_decode(priv, s, psmouse->packet,
+				     psmouse->packet_time);
+	fujitsu_scroll_report(psmouse, s, roll,
+			      psmouse->packet[4] & FJS_PRESSED,
+			      psmouse->packet_time);
+}
+
+/*
+ * Packet storms: while the packet rate is above storm_rate, packets are
+ * only queued from the interrupt handler and decoded in batches from a
+ * work item, with the scroll movement of a batch reported in one frame.
+ * The work item is the only one touching the decoding state until it
+ * hands processing back to the interrupt handler.
+ */
+static bool fujitsu_scroll_storm_check(struct fujitsu_scroll_data *priv,
+				       const struct fujitsu_scroll_settings *s)
+{
+	unsigned long now = jiffies;
+
+	if (time_after_eq(now, priv->window_start + FJS_STORM_WINDOW)) {
+		priv->window_rate =
+			time_before(now, priv->window_start +
+					 2 * FJS_STORM_WINDOW) ?
+			priv->window_count : 0;
+		priv->window_start = now;
+		priv->window_count = 0;
+	}
+
+	priv->window_count++;
+
+	if (!priv->storm && s->storm_packets &&
+	    priv->window_count > s->storm_packets) {
+		priv->storm = true;
+		priv->stats.storms++;
+		psmouse_dbg(priv->psmouse,
+			    "packet storm, deferring packet processing\n");
+	}
+
+	return priv->storm;
+}
+
+static void fujitsu_scroll_storm_queue(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_packet pkt;
+
+	/* A full queue means the work item is stuck; drop the packet */
+	memcpy(pkt.data, psmouse->packet, FJS_PACKET_SIZE);
+	pkt.time = psmouse->packet_time;
+	if (kfifo_put(&priv->storm_fifo, pkt))
+		priv->stats.deferred++;
+	else
+		priv->stats.dropped++;
+
+	queue_work(system_highpri_wq, &priv->storm_work);
+}
+
+static void fujitsu_scroll_storm_work(struct work_struct *work)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(work, struct fujitsu_scroll_data, storm_work);
+	struct psmouse *psmouse = priv->psmouse;
+	const struct fujitsu_scroll_settings *s;
+	struct fujitsu_scroll_packet pkt;
+	unsigned long elapsed;
+	ktime_t time = 0;
+	bool pressed;
+	int roll = 0;
+
+	rcu_read_lock();
+	s = rcu_dereference(priv->settings);
+
+	while (kfifo_get(&priv->storm_fifo, &pkt)) {
+		roll += fujitsu_scroll_decode(priv, s, pkt.data, pkt.time);
+
+		/* Key and slider changes are not merged, each gets a frame */
+		pressed = pkt.data[4] & FJS_PRESSED;
+		if (fujitsu_scroll_state_changed(priv, pressed)) {
+			fujitsu_scroll_report(psmouse, s, roll, pressed,
+					      pkt.time);
+			roll = 0;
+		}
+		time = pkt.time;
+	}
+
+	if (roll != 0)
+		fujitsu_scroll_report(psmouse, s, roll, priv->pressed, time);
+
+	/*
+	 * Hand processing back once the storm is over: the last full
+	 * window was calm and so is the current one up to now.  The queue
+	 * is checked with the interrupt handler held off, so no packet can
+	 * slip in between and be decoded out of order.
+	 */
+	serio_pause_rx(psmouse->ps2dev.serio);
+	elapsed = max(jiffies - priv->window_start, 1UL);
+	if (kfifo_is_empty(&priv->storm_fifo) &&
+	    priv->window_rate <= s->storm_packets / 2 &&
+	    priv->window_count * FJS_STORM_WINDOW <=
+			s->storm_packets / 2 * elapsed) {
+		priv->storm = false;
+		psmouse_dbg(psmouse, "packet storm over\n");
+	}
+	serio_continue_rx(psmouse->ps2dev.serio);
+
+	rcu_read_unlock();
+}
+
+/*
+ * Watches for a device that got stuck sending the same packet with a bit
+ * of capacitance, which decodes to nothing but keeps interrupts coming.
+ */
+static void fujitsu_scroll_watchdog(struct psmouse *psmouse,
+				    const struct fujitsu_scroll_settings *s)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	unsigned int capacitance = psmouse->packet[0] & 0x3f;
+
+	if (capacitance == 0 || capacitance >= s->threshold) {
+		priv->stuck_count = 0;
+		priv->stuck_limit = FJS_STUCK_PACKETS;
+		return;
+	}
+
+	if (memcmp(priv->stuck_packet, psmouse->packet, FJS_PACKET_SIZE)) {
+		memcpy(priv->stuck_packet, psmouse->packet, FJS_PACKET_SIZE);
+		priv->stuck_count = 0;
+		return;
+	}
+
+	if (++priv->stuck_count < priv->stuck_limit)
+		return;
+
+	/* Still stuck by the next time means re-arming did not help */
+	priv->stuck_count = 0;
+	priv->stuck_limit = min_t(unsigned int, priv->stuck_limit * 2,
+				  FJS_MAX_STUCK_PACKETS);
+	priv->stats.stuck++;
+	psmouse_dbg(psmouse, "device stuck, re-arming data mode\n");
+
+	WRITE_ONCE(priv->rearm, true);
+	psmouse_queue_work(psmouse, &priv->mode_work, 0);
+}
+
+static bool fujitsu_scroll_siblings_busy(struct psmouse *psmouse,
+					 ktime_t now)
+{
+	ktime_t last = psmouse_sibling_activity(psmouse);
+
+	return last && ktime_ms_delta(now, last) < FJS_YIELD_TIME;
+}
+
+/*
+ * Packets of a device nobody is touching only compete with those of the
+ * touchpad (or the other scroll device) for the shared interrupt, so
+ * back off while one of them is busy.
+ */
+static void fujitsu_scroll_arbitrate(struct psmouse *psmouse,
+				     const struct fujitsu_scroll_settings *s)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	ktime_t now = psmouse->packet_time;
+
+	if (!s->yield || priv->yielding)
+		return;
+
+	if ((psmouse->packet[0] & 0x3f) >= s->threshold) {
+		priv->last_touch = now;
+		return;
+	}
+
+	if (ktime_ms_delta(now, priv->last_touch) < FJS_YIELD_TIME ||
+	    !fujitsu_scroll_siblings_busy(psmouse, now))
+		return;
+
+	/* Yielding again right after the last yield: make this one longer */
+	if (priv->stats.yields &&
+	    ktime_ms_delta(now, READ_ONCE(priv->yield_end)) < priv->yield_hold)
+		priv->yield_hold = min_t(unsigned int, priv->yield_hold * 2,
+					 FJS_MAX_YIELD_HOLD);
+	else
+		priv->yield_hold = FJS_YIELD_TIME;
+
+	WRITE_ONCE(priv->yielding, s->yield);
+	priv->yield_start = now;
+	priv->stats.yields++;
+
+	psmouse_queue_work(psmouse, &priv->mode_work, 0);
+	psmouse_queue_work(psmouse, &priv->yield_work,
+			   msecs_to_jiffies(priv->yield_hold));
+}
+
+/*
+ * Measures the packet rate the device really achieves at its current
+ * report rate.  psmouse only updates last_packet once we are done.
+ */
+static void fujitsu_scroll_measure_rate(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_rate_stats *rs;
+	s64 gap = ktime_us_delta(psmouse->packet_time, psmouse->last_packet);
+
+	if (gap <= 0 || gap >= FJS_STREAM_GAP * USEC_PER_MSEC)
+		return;
+
+	rs = &priv->rate_stats[READ_ONCE(priv->rate_index)];
+	rs->packets++;
+	rs->us += gap;
+}
+
+/*
+ * Bytes 0 and 3 start with fixed bits; one that does not is misaligned
+ * or garbled, and psmouse resyncs on the next byte.
+ */
+static bool fujitsu_scroll_byte_valid(struct psmouse *psmouse)
+{
+	u8 byte = psmouse->packet[psmouse->pktcnt - 1];
+
+	switch (psmouse->pktcnt) {
+	case 1:
+		return (byte & FJS_FRAME_MASK) == FJS_FRAME_FIRST;
+	case 4:
+		return (byte & FJS_FRAME_MASK) == FJS_FRAME_SECOND;
+	default:
+		return true;
+	}
+}
+
+static psmouse_ret_t fujitsu_scroll_process_byte(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	const struct fujitsu_scroll_settings *s;
+
+	if (!fujitsu_scroll_byte_valid(psmouse)) {
+		priv->stats.invalid++;
+		return PSMOUSE_BAD_DATA;
+	}
+
+	if (psmouse->pktcnt >= FJS_PACKET_SIZE) {	/* Full packet received */
+		priv->stats.packets++;
+
+		rcu_read_lock();
+		s = rcu_dereference(priv->settings);
+
+		fujitsu_scroll_measure_rate(psmouse);
+		fujitsu_scroll_watchdog(psmouse, s);
+		fujitsu_scroll_arbitrate(psmouse, s);
+
+		if (fujitsu_scroll_storm_check(priv, s))
+			fujitsu_scroll_storm_queue(psmouse);
+		else
+			fujitsu_scroll_process_packet(psmouse, s);
+
+		rcu_read_unlock();
+		return PSMOUSE_FULL_PACKET;
+	}
+
+	return PSMOUSE_GOOD_DATA;
+}
+
+/*****************************************************************************
+ *	Statistics
+ ****************************************************************************/
+
+static int fujitsu_scroll_stats_show(struct seq_file *m, void *unused)
+{
+	struct fujitsu_scroll_data *priv = m->private;
+	const struct fujitsu_scroll_stats *stats = &priv->stats;
+
+	seq_printf(m, "packets: %lu\n", READ_ONCE(stats->packets));
+	seq_printf(m, "frames: %lu\n", READ_ONCE(stats->frames));
+	seq_printf(m, "syncs_skipped: %lu\n", READ_ONCE(stats->syncs_skipped));
+	seq_printf(m, "storms: %lu\n", READ_ONCE(stats->storms));
+	seq_printf(m, "deferred: %lu\n", READ_ONCE(stats->deferred));
+	seq_printf(m, "dropped: %lu\n", READ_ONCE(stats->dropped));
+	seq_printf(m, "taps: %lu\n", READ_ONCE(stats->taps));
+	seq_printf(m, "double_taps: %lu\n", READ_ONCE(stats->double_taps));
+	seq_printf(m, "holds: %lu\n", READ_ONCE(stats->holds));
+	seq_printf(m, "two_fingers: %lu\n", READ_ONCE(stats->two_fingers));
+	seq_printf(m, "palms: %lu\n", READ_ONCE(stats->palms));
+	seq_printf(m, "palm_packets: %lu\n", READ_ONCE(stats->palm_packets));
+	seq_printf(m, "unwrapped: %lu\n", READ_ONCE(stats->unwrapped));
+	seq_printf(m, "implausible: %lu\n", READ_ONCE(stats->implausible));
+	seq_printf(m, "invalid: %lu\n", READ_ONCE(stats->invalid));
+	seq_printf(m, "stuck: %lu\n", READ_ONCE(stats->stuck));
+	seq_printf(m, "yields: %lu\n", READ_ONCE(stats->yields));
+	seq_printf(m, "yield_ms: %lu\n", READ_ONCE(stats->yield_ms));
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fujitsu_scroll_stats);
+
+/* Packets per second achieved at each report rate used so far */
+static int fujitsu_scroll_rates_show(struct seq_file *m, void *unused)
+{
+	struct fujitsu_scroll_data *priv = m->private;
+	const struct fujitsu_scroll_rate_stats *rs;
+	unsigned long packets;
+	u64 us;
+	int i;
+
+	for (i = 0; i < FJS_NUM_RATES; i++) {
+		rs = &priv->rate_stats[i];
+		packets = READ_ONCE(rs->packets);
+		us = READ_ONCE(rs->us);
+		if (!packets || !us)
+			continue;
+
+		seq_printf(m, "%u: %llu pps (%lu packets)\n",
+			   fujitsu_scroll_rates[i],
+			   div64_u64((u64)packets * USEC_PER_SEC, us), packets);
+	}
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(fujitsu_scroll_rates);
+
+static void fujitsu_scroll_debugfs_init(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct serio *serio = psmouse->ps2dev.serio;
+
+	priv->debugfs = debugfs_create_dir(dev_name(&serio->dev),
+					   fujitsu_scroll_debugfs_root);
+	debugfs_create_file("stats", S_IRUSR, priv->debugfs, priv,
+			    &fujitsu_scroll_stats_fops);
+	debugfs_create_file("rates", S_IRUSR, priv->debugfs, priv,
+			    &fujitsu_scroll_rates_fops);
+}
+
+/*****************************************************************************
+ *	Driver initialization/cleanup functions
+ ****************************************************************************/
+
+/*
+ * Brings the mode of an active device in line with the wanted one, or
+ * re-arms it if it got stuck.
+ * Runs on the psmouse workqueue so it does not race with resync, and
+ * under psmouse_mutex so it does not race with connect, reconnect or
+ * the sysfs attributes either.  While any of those is busy with the
+ * device we try again a bit later; one that has been given up on gets
+ * its mode from reconnect.  A device with data mode off sends nothing,
+ * so it is only disabled around the commands when data mode is on, and
+ * only for a new mode byte: a new report rate alone, which is what
+ * yielding and coming back from it need, is sent to the running device.
+ */
+static void fujitsu_scroll_mode_work(struct work_struct *work)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(work, struct fujitsu_scroll_data, mode_work.work);
+	struct psmouse *psmouse = priv->psmouse;
+
+	if (!psmouse_trylock()) {
+		psmouse_queue_work(psmouse, &priv->mode_work, HZ / 10);
+		return;
+	}
+
+	mutex_lock(&priv->mode_mutex);
+
+	if (fujitsu_scroll_mode_stale(priv)) {
+		if (psmouse->state != PSMOUSE_ACTIVATED) {
+			if (psmouse->state != PSMOUSE_IGNORE)
+				psmouse_queue_work(psmouse, &priv->mode_work,
+						   HZ / 10);
+		} else if (!(priv->mode & FJS_MODE_ENABLE)) {
+			fujitsu_scroll_update_mode(psmouse);
+		} else if (!fujitsu_scroll_mode_byte_stale(priv)) {
+			/*
+			 * Stop decoding rather than the device: bytes it
+			 * sends until it takes the command are dropped, and
+			 * it starts on a fresh packet once it has answered.
+			 */
+			psmouse_set_state(psmouse, PSMOUSE_INITIALIZING);
+			fujitsu_scroll_update_mode(psmouse);
+			psmouse_set_state(psmouse, PSMOUSE_ACTIVATED);
+		} else if (!psmouse_deactivate(psmouse)) {
+			fujitsu_scroll_update_mode(psmouse);
+			psmouse_activate(psmouse);
+		}
+	}
+
+	mutex_unlock(&priv->mode_mutex);
+	psmouse_unlock();
+}
+
+/* Takes the device back to its full rate once the others are quiet */
+static void fujitsu_scroll_yield_work(struct work_struct *work)
+{
+	struct fujitsu_scroll_data *priv =
+		container_of(work, struct fujitsu_scroll_data, yield_work.work);
+	struct psmouse *psmouse = priv->psmouse;
+	ktime_t now = ktime_get();
+
+	if (fujitsu_scroll_siblings_busy(psmouse, now)) {
+		psmouse_queue_work(psmouse, &priv->yield_work,
+				   msecs_to_jiffies(FJS_YIELD_TIME));
+		return;
+	}
+
+	priv->stats.yield_ms += ktime_ms_delta(now, priv->yield_start);
+	WRITE_ONCE(priv->yield_end, now);
+	WRITE_ONCE(priv->yielding, FJS_YIELD_NONE);
+	psmouse_queue_work(psmouse, &priv->mode_work, 0);
+}
+
+/*
+ * The input device outlives our private data on disconnect and protocol
+ * change, which detach it under fujitsu_scroll_open_mutex; with that
+ * held, a device still attached is ours.
+ */
+static void fujitsu_scroll_set_open(struct input_dev *dev, bool open)
+{
+	struct psmouse *psmouse;
+	struct fujitsu_scroll_data *priv;
+
+	mutex_lock(&fujitsu_scroll_open_mutex);
+
+	psmouse = input_get_drvdata(dev);
+	if (psmouse) {
+		priv = psmouse->private;
+		WRITE_ONCE(priv->open, open);
+		psmouse_queue_work(psmouse, &priv->mode_work, 0);
+	}
+
+	mutex_unlock(&fujitsu_scroll_open_mutex);
+}
+
+static int fujitsu_scroll_open(struct input_dev *dev)
+{
+	fujitsu_scroll_set_open(dev, true);
+	return 0;
+}
+
+static void fujitsu_scroll_close(struct input_dev *dev)
+{
+	fujitsu_scroll_set_open(dev, false);
+}
+
+static void fujitsu_scroll_shared_set_open(struct fujitsu_scroll_shared *shared,
+					   bool open)
+{
+	struct fujitsu_scroll_data *priv;
+	unsigned long flags;
+	int i;
+
+	spin_lock_irqsave(&shared->lock, flags);
+
+	shared->open = open;
+	for (i = 0; i < FUJITSU_SCROLL_NUM_TYPES; i++) {
+		priv = shared->members[i];
+		if (priv) {
+			WRITE_ONCE(priv->open, open);
+			psmouse_queue_work(priv->psmouse, &priv->mode_work, 0);
+		}
+	}
+
+	spin_unlock_irqrestore(&shared->lock, flags);
+}
+
+static int fujitsu_scroll_shared_open(struct input_dev *dev)
+{
+	fujitsu_scroll_shared_set_open(input_get_drvdata(dev), true);
+	return 0;
+}
+
+static void fujitsu_scroll_shared_close(struct input_dev *dev)
+{
+	fujitsu_scroll_shared_set_open(input_get_drvdata(dev), false);
+}
+
+static struct fujitsu_scroll_shared *fujitsu_scroll_shared_create(void)
+{
+	struct fujitsu_scroll_shared *shared;
+	struct input_dev *dev;
+
+	shared = kzalloc(sizeof(*shared), GFP_KERNEL);
+	dev = input_allocate_device();
+	if (!shared || !dev)
+		goto err_free;
+
+	spin_lock_init(&shared->lock);
+	shared->dev = dev;
+
+	dev->name = "Fujitsu Scroll Devices";
+	dev->phys = "fujitsu_scroll/input0";
+	dev->id.bustype = BUS_I8042;
+	dev->id.vendor = 0x0002;
+	dev->id.product = PSMOUSE_FUJITSU_SCROLL;
+
+	fujitsu_scroll_set_caps(dev, BIT(FUJITSU_SCROLL_WHEEL) |
+				     BIT(FUJITSU_SCROLL_SENSOR));
+
+	input_set_drvdata(dev, shared);
+	dev->open = fujitsu_scroll_shared_open;
+	dev->close = fujitsu_scroll_shared_close;
+
+	return shared;
+
+err_free:
+	input_free_device(dev);
+	kfree(shared);
+	return NULL;
+}
+
+/*
+ * Joins the device shared by the Wheel and the Sensor, creating it if
+ * this is the first of them.  Fails if a device of the same type has
+ * already joined, the caller then falls back to a device of its own.
+ */
+static int fujitsu_scroll_shared_get(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_shared *shared;
+	unsigned long flags;
+	int error = 0;
+
+	mutex_lock(&fujitsu_scroll_shared_mutex);
+
+	shared = fujitsu_scroll_shared;
+	if (!shared) {
+		shared = fujitsu_scroll_shared_create();
+		if (!shared) {
+			error = -ENOMEM;
+			goto out;
+		}
+
+		/* Parent it to the controller, which outlives both ports */
+		shared->dev->dev.parent = psmouse->ps2dev.serio->dev.parent;
+
+		error = input_register_device(shared->dev);
+		if (error) {
+			input_free_device(shared->dev);
+			kfree(shared);
+			goto out;
+		}
+
+		fujitsu_scroll_shared = shared;
+	} else if (shared->members[priv->type]) {
+		error = -EBUSY;
+		goto out;
+	}
+
+	shared->refcount++;
+
+	spin_lock_irqsave(&shared->lock, flags);
+	shared->members[priv->type] = priv;
+	priv->open = shared->open;
+	spin_unlock_irqrestore(&shared->lock, flags);
+
+	priv->shared = shared;
+
+out:
+	mutex_unlock(&fujitsu_scroll_shared_mutex);
+	return error;
+}
+
+static void fujitsu_scroll_shared_put(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+	struct fujitsu_scroll_shared *shared = priv->shared;
+	unsigned long flags;
+
+	spin_lock_irqsave(&shared->lock, flags);
+	shared->members[priv->type] = NULL;
+	spin_unlock_irqrestore(&shared->lock, flags);
+
+	mutex_lock(&fujitsu_scroll_shared_mutex);
+	if (!--shared->refcount) {
+		fujitsu_scroll_shared = NULL;
+		input_unregister_device(shared->dev);
+		kfree(shared);
+	}
+	mutex_unlock(&fujitsu_scroll_shared_mutex);
+
+	priv->shared = NULL;
+}
+
+static void fujitsu_scroll_disconnect(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+
+	debugfs_remove_recursive(priv->debugfs);
+	device_remove_group(&psmouse->ps2dev.serio->dev,
+			    &fujitsu_scroll_attr_group);
+	psmouse_reset(psmouse);
+
+	/* Stop packet processing, nothing may report once we are gone */
+	psmouse_set_state(psmouse, PSMOUSE_IGNORE);
+
+	cancel_work_sync(&priv->storm_work);
+	fujitsu_scroll_reset_touch(priv);
+	cancel_delayed_work_sync(&priv->yield_work);
+
+	/* Nor may open and close queue work from now on */
+	if (priv->shared) {
+		fujitsu_scroll_shared_put(psmouse);
+	} else {
+		mutex_lock(&fujitsu_scroll_open_mutex);
+		input_set_drvdata(psmouse->dev, NULL);
+		mutex_unlock(&fujitsu_scroll_open_mutex);
+	}
+
+	cancel_delayed_work_sync(&priv->mode_work);
+
+	kfree(rcu_dereference_protected(priv->settings, true));
+	kfree(priv);
+	psmouse->private = NULL;
+}
+
+static int fujitsu_scroll_reconnect(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv = psmouse->private;
+
+	psmouse_reset(psmouse);
+
+	/* Whatever was queued or counted before the reset is stale */
+	cancel_work_sync(&priv->storm_work);
+	kfifo_reset(&priv->storm_fifo);
+	priv->storm = false;
+	priv->window_start = jiffies;
+	priv->window_count = 0;
+	priv->window_rate = 0;
+
+	mutex_lock(&priv->mode_mutex);
+	fujitsu_scroll_init_sequence(psmouse);
+	mutex_unlock(&priv->mode_mutex);
+
+	return 0;
+}
+
+int fujitsu_scroll_init(struct psmouse *psmouse)
+{
+	struct fujitsu_scroll_data *priv;
+	int error;
+
+	psmouse_reset(psmouse);
+
+	psmouse->private = priv = kzalloc(sizeof(struct fujitsu_scroll_data),
+					  GFP_KERNEL);
+	if (!priv)
+		return -ENOMEM;
+
+	priv->psmouse = psmouse;
+	priv->dpad_sector = -1;
+	priv->stuck_limit = FJS_STUCK_PACKETS;
+	priv->slider_want = priv->slider_level = -1;
+	spin_lock_init(&priv->frame_lock);
+	hrtimer_setup(&priv->dpad_timer, fujitsu_scroll_dpad_repeat,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_setup(&priv->cont_timer, fujitsu_scroll_cont_tick,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	hrtimer_setup(&priv->gesture_timer, fujitsu_scroll_gesture_timeout,
+		      CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	mutex_init(&priv->mode_mutex);
+	INIT_DELAYED_WORK(&priv->mode_work, fujitsu_scroll_mode_work);
+	INIT_DELAYED_WORK(&priv->yield_work, fujitsu_scroll_yield_work);
+	INIT_WORK(&priv->storm_work, fujitsu_scroll_storm_work);
+	INIT_KFIFO(priv->storm_fifo);
+
+	psmouse->protocol_handler = fujitsu_scroll_process_byte;
+	psmouse->pktsize = FJS_PACKET_SIZE;
+
+	psmouse->set_rate = fujitsu_scroll_set_rate;
+	psmouse->set_resolution = fujitsu_scroll_set_resolution;
+	psmouse->set_scale = fujitsu_scroll_set_scale;
+	psmouse->disconnect = fujitsu_scroll_disconnect;
+	psmouse->reconnect = fujitsu_scroll_reconnect;
+	psmouse->resync_time = 0;
+
+	fujitsu_scroll_query_hardware(psmouse);
+
+	/* The default mapping depends on whether the device is shared */
+	if (fujitsu_merge)
+		fujitsu_scroll_shared_get(psmouse);
+	priv->dev = priv->shared ? priv->shared->dev : psmouse->dev;
+
+	error = fujitsu_scroll_init_settings(psmouse);
+	if (error)
+		goto err_put_shared;
+
+	error = device_add_group(&psmouse->ps2dev.serio->dev,
+				 &fujitsu_scroll_attr_group);
+	if (error) {
+		psmouse_err(psmouse,
+			    "failed to create sysfs attributes, error: %d\n",
+			    error);
+		goto err_free_settings;
+	}
+
+	fujitsu_scroll_debugfs_init(psmouse);
+
+	/*
+	 * Data mode stays off until the device is opened.  A shared
+	 * device is opened and closed through the shared input device,
+	 * the one psmouse allocated for us is then not registered at all.
+	 */
+	if (priv->shared) {
+		psmouse->input_elsewhere = true;
+	} else {
+		input_set_drvdata(psmouse->dev, psmouse);
+		psmouse->dev->open = fujitsu_scroll_open;
+		psmouse->dev->close = fujitsu_scroll_close;
+		fujitsu_scroll_set_caps(psmouse->dev, BIT(priv->type));
+	}
+
+	mutex_lock(&priv->mode_mutex);
+	fujitsu_scroll_init_sequence(psmouse);
+	mutex_unlock(&priv->mode_mutex);
+
+	return 0;
+
+err_free_settings:
+	kfree(rcu_dereference_protected(priv->settings, true));
+err_put_shared:
+	if (priv->shared) {
+		fujitsu_scroll_shared_put(psmouse);
+		cancel_delayed_work_sync(&priv->mode_work);
+	}
+	kfree(priv);
+	psmouse->private = NULL;
+	return error;
 }
 
 #endif /* CONFIG_MOUSE_PS2_FUJITSU_SCROLL */
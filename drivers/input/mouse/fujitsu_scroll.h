@@ -7,6 +7,14 @@
 #ifndef _FUJITSU_SCROLL_H
 #define _FUJITSU_SCROLL_H
 
+#include <linux/rcupdate.h>
+#include <linux/reciprocal_div.h>
+#include <linux/hrtimer.h>
+#include <linux/kfifo.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+
 #ifdef CONFIG_MOUSE_PS2_FUJITSU_SCROLL
 
 #define FJS_RANGE        0x01000
@@ -31,6 +39,12 @@
 #define FJS_WHEEL_AXIS                 REL_WHEEL
 #define FJS_SENSOR_AXIS                REL_HWHEEL
 
+/*
+ * Most codes the fujitsu_keys and fujitsu_rels module parameters can add
+ * to what the event maps may use
+ */
+#define FJS_MAX_EXTRA_CODES            16
+
 /*
  * Speed of scrolling.
  * 1 is very fast, 4000 is very slow.
@@ -44,25 +58,471 @@
  */
 #define FJS_INIT_MODE              0x80
 
+#define FJS_MODE_ENABLE            0x80
+#define FJS_MODE_PRESS_ONLY        0x20
+
+/*
+ * A SET RATE with this parameter right after the sliced command is what
+ * makes the device take the mode byte; a plain SET RATE after that sets
+ * the report rate.
+ */
+#define FJS_MODE_RATE              20
+
+/*
+ * The report rates a plain SET RATE can ask for.  Packets less than
+ * FJS_STREAM_GAP ms apart count towards the rate measured at each.
+ */
+#define FJS_NUM_RATES              7
+#define FJS_STREAM_GAP             100
+
+/*
+ * Bytes 0 and 3 start with fixed bits (10 and 11), which frame a packet
+ */
+#define FJS_FRAME_MASK             0xc0
+#define FJS_FRAME_FIRST            0x80
+#define FJS_FRAME_SECOND           0xc0
+
+/*
+ * Byte 4 bit 4 - the hidden press region is being touched
+ */
+#define FJS_PRESSED                0x10
+#define FJS_PRESS_BUTTON           BTN_MIDDLE
+/* The Sensor's press region when both devices share one input device */
+#define FJS_SENSOR_MERGED_BUTTON   BTN_SIDE
+
 #define FJS_MAX_POS_CHG  (FJS_MAX_POS / 2)
 
+/*
+ * Calibration: raw positions are linearized through FJS_CAL_KNOTS values,
+ * those of raw positions 0, FJS_CAL_STEP, ... FJS_RANGE, interpolated in
+ * between.  Touched positions are counted in FJS_CAL_BINS bins to learn
+ * the table from, once there are FJS_CAL_MIN_SAMPLES of them.  Bins with
+ * less than 1/2^FJS_CAL_NOISE_SHIFT of the samples are not taken as the
+ * ends of the Sensor.
+ */
+#define FJS_CAL_SHIFT               8
+#define FJS_CAL_STEP                (1 << FJS_CAL_SHIFT)
+#define FJS_CAL_KNOTS               (FJS_RANGE / FJS_CAL_STEP + 1)
+#define FJS_CAL_BIN_SHIFT           6
+#define FJS_CAL_BINS                (FJS_RANGE >> FJS_CAL_BIN_SHIFT)
+#define FJS_CAL_MIN_SAMPLES         2048
+#define FJS_CAL_NOISE_SHIFT         10
+
+/*
+ * Unwrapping of the Wheel's angle.  The angular velocity is tracked in
+ * positions per ms, fixed point with FJS_VELOCITY_SHIFT fractional bits,
+ * and forgotten after FJS_VELOCITY_WINDOW ms without a packet.  A finger
+ * turns the Wheel at most FJS_MAX_SPIN positions per ms (about 6 turns a
+ * second); changes beyond that, plus FJS_SPIN_SLACK, are rejected.
+ */
+#define FJS_VELOCITY_SHIFT          8
+#define FJS_VELOCITY_WINDOW         100
+#define FJS_MAX_SPIN                24
+#define FJS_SPIN_SLACK              (FJS_RANGE / 16)
+
+/*
+ * Limits of the per-device tunables.
+ * The filter is an exponential moving average over movement, weighted
+ * 1 / 2^filter and kept scaled by 2^filter so that no movement is lost
+ * to rounding; acceleration adds movement^2 * accel / 2^FJS_ACCEL_SHIFT.
+ */
+#define FJS_MAX_CAPACITANCE         0x3f
+#define FJS_MAX_FILTER              4
+#define FJS_MAX_ACCEL               64
+#define FJS_ACCEL_SHIFT             10
+
+/*
+ * Yielding to the other ports behind the controller: a device that is
+ * not being touched, while another port had a packet within the last
+ * FJS_YIELD_TIME ms, drops to FJS_YIELD_RATE packets per second or turns
+ * data mode off, until the others have been quiet for FJS_YIELD_TIME ms.
+ * A yield lasts at least yield_hold ms: FJS_YIELD_TIME, doubled up to
+ * FJS_MAX_YIELD_HOLD for each yield that follows the previous one more
+ * closely than that.
+ */
+#define FJS_YIELD_NONE              0
+#define FJS_YIELD_RATE              1
+#define FJS_YIELD_OFF               2
+#define FJS_YIELD_TIME              200
+#define FJS_MAX_YIELD_HOLD          (FJS_YIELD_TIME << 4)
+#define FJS_YIELD_REPORT_RATE       10U
+
+/*
+ * A device sending FJS_STUCK_PACKETS identical packets in a row, with a
+ * capacitance above 0 but below the threshold, is taken as stuck and has
+ * its data mode re-armed.  Each re-arm that does not help doubles the
+ * number of packets until the next one, up to FJS_MAX_STUCK_PACKETS; a
+ * packet with no or enough capacitance starts over.
+ */
+#define FJS_STUCK_PACKETS           400
+#define FJS_MAX_STUCK_PACKETS       (FJS_STUCK_PACKETS << 5)
+
+/*
+ * Above FJS_STORM_RATE packets per second, measured over FJS_STORM_WINDOW,
+ * packets are queued (up to FJS_STORM_QUEUE of them) and decoded in
+ * batches.  Processing goes back to immediate once the rate halves.
+ */
+#define FJS_STORM_RATE              250
+#define FJS_MAX_STORM_RATE          10000
+#define FJS_STORM_WINDOW            (HZ / 10)
+#define FJS_STORM_QUEUE             32
+
+/*
+ * D-pad mode of the Wheel: the angle is split into FJS_DPAD_SECTORS (4)
+ * or twice that sectors, the first one centered on position 0.  A
+ * sector is only left once the finger is 1/2^FJS_DPAD_HYSTERESIS_SHIFT
+ * of a sector past its edge.  Held directions repeat every dpad_repeat
+ * ms after FJS_DPAD_REPEAT_DELAY ms.
+ */
+#define FJS_DPAD_SECTORS            4
+#define FJS_DPAD_HYSTERESIS_SHIFT   3
+#define FJS_DPAD_REPEAT_DELAY       250
+#define FJS_MAX_DPAD_REPEAT         1000
+
+/*
+ * Continuous scrolling.  On the Wheel (jog shuttle) the angle from the
+ * touch-down point sets the rate, from nothing within FJS_SHUTTLE_DEAD
+ * up to continuous_rate notches per second at FJS_SHUTTLE_RANGE.  On the
+ * Sensor a finger resting within edge_zone of either end scrolls at
+ * continuous_rate.
+ */
+#define FJS_SHUTTLE_DEAD            (FJS_RANGE / 64)
+#define FJS_SHUTTLE_RANGE           (FJS_RANGE / 4)
+#define FJS_CONTINUOUS_RATE         20
+#define FJS_MAX_CONTINUOUS_RATE     200
+#define FJS_EDGE_ZONE               (FJS_RANGE / 10)
+
+/*
+ * A device that sent no packet for FJS_SILENCE_TIMEOUT ms, well above
+ * the 100 ms between packets at the lowest report rate, has stopped
+ * sending and nothing of the touch it reported may keep going: the
+ * continuous scrolling and D-pad repeat timers stop on their own then.
+ */
+#define FJS_SILENCE_TIMEOUT         250
+
+/*
+ * Slider mode of the Sensor: the position, left end first, is split into
+ * slider levels reported on FJS_SLIDER_AXIS.  A level is only left once
+ * the finger is a quarter of a level past its edge.
+ */
+#define FJS_SLIDER_AXIS             ABS_MISC
+#define FJS_MAX_SLIDER_LEVELS       256
+
+/*
+ * Gestures on the press region: touches shorter than FJS_TAP_DEBOUNCE ms
+ * are ignored, one released within FJS_HOLD_TIME ms is a tap, or a double
+ * tap if another touch follows within FJS_DOUBLE_TAP_TIME ms, and longer
+ * ones are holds.  A capacitance rise of FJS_TWO_FINGER_JUMP from one
+ * packet to the next, with the position moving less than
+ * FJS_TWO_FINGER_STILL, is a second finger; it is taken as gone once
+ * capacitance falls back halfway.  Two fingers scroll fast_scroll times
+ * as fast.
+ */
+#define FJS_TAP_DEBOUNCE            20
+#define FJS_HOLD_TIME               400
+#define FJS_DOUBLE_TAP_TIME         250
+#define FJS_TWO_FINGER_JUMP         12
+#define FJS_TWO_FINGER_STILL        (FJS_RANGE / 128)
+#define FJS_FAST_SCROLL             4
+#define FJS_MAX_FAST_SCROLL         16
+
+/*
+ * Palm rejection.  Each packet of a touch adds FJS_PALM_ONE to a score
+ * for every sign of a palm it shows: capacitance at or above the palm
+ * level, capacitance rising by FJS_PALM_RISE or more per 10 ms (only
+ * judged between packets less than FJS_PALM_RISE_WINDOW ms apart), and
+ * a position jump beyond FJS_PALM_JUMP.  The score decays by
+ * 1/2^FJS_PALM_DECAY_SHIFT per packet; a touch whose score reaches
+ * FJS_PALM_REJECT is ignored until it is lifted.
+ */
+#define FJS_PALM_ONE                256
+#define FJS_PALM_REJECT             (2 * FJS_PALM_ONE)
+#define FJS_PALM_DECAY_SHIFT        2
+#define FJS_PALM_RISE               20
+#define FJS_PALM_RISE_WINDOW        50
+#define FJS_PALM_JUMP               (FJS_RANGE / 8)
+
 enum fujitsu_scroll_device_type {
 	FUJITSU_SCROLL_WHEEL,
-	FUJITSU_SCROLL_SENSOR
+	FUJITSU_SCROLL_SENSOR,
+	FUJITSU_SCROLL_NUM_TYPES
+};
+
+/*
+ * What the device is asked to report while it is open:
+ * everything, only changes of the press region, or nothing.
+ */
+enum fujitsu_scroll_op_mode {
+	FUJITSU_SCROLL_FULL,
+	FUJITSU_SCROLL_PRESS_ONLY,
+	FUJITSU_SCROLL_OFF
+};
+
+/*
+ * Events of a device that can be mapped to input events: scrolling
+ * up (or left on the Sensor), scrolling down, and the press region.
+ * With gestures enabled, the press region is reported as a tap, a
+ * double tap or a hold; when nothing is mapped to the latter two they
+ * are reported as two taps and as the press held down.
+ */
+enum fujitsu_scroll_event {
+	FJS_EVENT_UP,
+	FJS_EVENT_DOWN,
+	FJS_EVENT_PRESS,
+	FJS_EVENT_DOUBLE_TAP,
+	FJS_EVENT_HOLD,
+	FJS_NUM_EVENTS
+};
+
+enum fujitsu_scroll_gesture {
+	FJS_GESTURE_IDLE,
+	FJS_GESTURE_PRESSED,
+	FJS_GESTURE_HELD,
+	FJS_GESTURE_TAPPED,		/* waiting for a second tap */
+	FJS_GESTURE_PRESSED_AGAIN,
+};
+
+/*
+ * What an event is reported as: EV_REL code with the signed number of
+ * notches (1 for press), EV_KEY code clicked once per notch (held for
+ * press), or nothing if type is 0.
+ */
+struct fujitsu_scroll_action {
+	u16 type;
+	u16 code;
+};
+
+/*
+ * A packet on its way through the decoding stages.  Stages fill in the
+ * position and capacitance, the movement since the last packet, and the
+ * notches and continuous scrolling rate it results in.
+ */
+struct fujitsu_scroll_sample {
+	const u8 *packet;
+	ktime_t time;
+	unsigned int position;
+	unsigned int capacitance;
+	int movement;
+	int roll;
+	int cont_rate;
+};
+
+struct fujitsu_scroll_data;
+struct fujitsu_scroll_settings;
+
+/* Returns false when the packet needs no further stages */
+typedef bool (*fujitsu_scroll_stage_fn)(struct fujitsu_scroll_data *priv,
+					const struct fujitsu_scroll_settings *s,
+					struct fujitsu_scroll_sample *smp);
+
+#define FJS_MAX_STAGES		4
+
+/*
+ * Tunables of one device.  A snapshot is never modified once published;
+ * writers copy it, validate the new value, recompute the derived fields
+ * and swap the pointer, so the packet path sees a consistent set.
+ */
+struct fujitsu_scroll_settings {
+	unsigned int threshold;
+	unsigned int speed;
+	unsigned int invert;
+	struct fujitsu_scroll_action map[FJS_NUM_EVENTS];
+	unsigned int filter;
+	unsigned int accel;
+	unsigned int storm_rate;
+	unsigned int timestamp;
+	unsigned int dpad;		/* 0, 4 or 8 sectors */
+	unsigned int dpad_buttons;	/* BTN_DPAD_* instead of arrow keys */
+	unsigned int dpad_repeat;
+	unsigned int continuous;
+	unsigned int continuous_rate;
+	unsigned int edge_zone;
+	unsigned int slider;		/* 0 or number of levels */
+	unsigned int gestures;
+	unsigned int fast_scroll;
+	unsigned int palm;		/* capacitance level, 0 disables */
+	unsigned int calibrated;	/* cal is not the identity */
+	unsigned int cal_capture;	/* positions counted in cal_hist */
+	u16 cal[FJS_CAL_KNOTS];
+	unsigned int yield;		/* FJS_YIELD_* */
+
+	/* derived at write time */
+	struct reciprocal_value speed_recip;
+	unsigned int storm_packets;
+	/* optional stages before touch tracking and after motion */
+	fujitsu_scroll_stage_fn stages[FJS_MAX_STAGES];
+	unsigned int num_stages;
+	fujitsu_scroll_stage_fn transforms[FJS_MAX_STAGES];
+	unsigned int num_transforms;
+
+	struct rcu_head rcu;
+};
+
+struct fujitsu_scroll_packet {
+	u8 data[FJS_PACKET_SIZE];
+	ktime_t time;
+};
+
+/*
+ * Exposed through debugfs.  syncs_skipped counts packets that produced
+ * no event and therefore no input frame.
+ */
+struct fujitsu_scroll_stats {
+	unsigned long packets;
+	unsigned long frames;
+	unsigned long syncs_skipped;
+	unsigned long storms;
+	unsigned long deferred;
+	unsigned long dropped;
+	unsigned long taps;
+	unsigned long double_taps;
+	unsigned long holds;
+	unsigned long two_fingers;
+	unsigned long palms;
+	unsigned long palm_packets;
+	unsigned long unwrapped;
+	unsigned long implausible;
+	unsigned long invalid;
+	unsigned long stuck;
+	unsigned long yields;
+	unsigned long yield_ms;
+};
+
+/* Packets received at one report rate and the time they took */
+struct fujitsu_scroll_rate_stats {
+	unsigned long packets;
+	u64 us;
+};
+
+struct fujitsu_scroll_data;
+
+/*
+ * With fujitsu_merge set, the Wheel and the Sensor report through one
+ * input device, which is kept until the last of them is disconnected.
+ * lock protects members and open and keeps the frames of the two
+ * devices from interleaving.
+ */
+struct fujitsu_scroll_shared {
+	struct input_dev *dev;
+	unsigned int refcount;
+	spinlock_t lock;
+	struct fujitsu_scroll_data *members[FUJITSU_SCROLL_NUM_TYPES];
+	bool open;
 };
 
 struct fujitsu_scroll_data {
+	struct psmouse *psmouse;
 	enum fujitsu_scroll_device_type type;
-	unsigned int axis;
+	struct fujitsu_scroll_settings __rcu *settings;
+	struct fujitsu_scroll_shared *shared;
+	struct input_dev *dev;		/* shared->dev or psmouse->dev */
+	spinlock_t frame_lock;		/* unless shared, see there */
+
+	/*
+	 * Data mode is only enabled while the input device is open.
+	 * mode_mutex serializes sending of the mode byte, mode holds
+	 * the last one sent.
+	 */
+	struct mutex mode_mutex;
+	struct delayed_work mode_work;
+	enum fujitsu_scroll_op_mode op_mode;
+	bool open;
+	bool rearm;			/* mode to be sent again, from off */
+	u8 mode;
+	u8 rate;
+	unsigned int rate_index;	/* of rate in fujitsu_scroll_rates */
+	struct fujitsu_scroll_rate_stats rate_stats[FJS_NUM_RATES];
+
+	/* yielding to the other ports: how (FJS_YIELD_*) and since when */
+	unsigned int yielding;
+	ktime_t yield_start;
+	ktime_t yield_end;		/* of the previous yield */
+	unsigned int yield_hold;	/* minimum length of a yield, ms */
+	ktime_t last_touch;
+	struct delayed_work yield_work;
+
+	/* stuck sensor watchdog: the repeated packet and how often */
+	u8 stuck_packet[FJS_PACKET_SIZE];
+	unsigned int stuck_count;
+	unsigned int stuck_limit;	/* packets until the next re-arm */
+
 	unsigned int last_event_position;
+	ktime_t last_event_time;
+	int velocity;			/* Wheel only, see FJS_VELOCITY_SHIFT */
 	unsigned int finger_down:1;
 	int movement;
+	int smoothed;			/* scaled by 2^filter */
+	bool pressed;
+	struct fujitsu_scroll_action press_action; /* what press reported */
+
+	/* D-pad: directions (bit per FJS_DPAD_SECTORS) wanted and reported */
+	int dpad_sector;
+	unsigned int dpad_want;
+	unsigned int dpad_down;
+	unsigned int dpad_keyset;
+	ktime_t dpad_changed;		/* when dpad_down last changed */
+	struct hrtimer dpad_timer;
+	bool dpad_running;		/* dpad_timer armed, frame lock */
+
+	/* slider: level wanted and reported, -1 for none yet */
+	int slider_want;
+	int slider_level;
+
+	/* continuous scrolling: signed notches per second */
+	unsigned int anchor;
+	int cont_rate;
+	struct hrtimer cont_timer;
+	bool cont_running;		/* cont_timer armed, frame lock */
+
+	/*
+	 * gestures: state of the press region since gesture_start, the
+	 * timeout of that state, and the capacitance seen with one finger
+	 * before a second one was detected
+	 */
+	enum fujitsu_scroll_gesture gesture;
+	ktime_t gesture_start;
+	ktime_t gesture_deadline;
+	struct hrtimer gesture_timer;
+	unsigned int capacitance;
+	unsigned int one_finger;
+	bool two_fingers;
+
+	/* palm rejection: evidence against the current touch */
+	int palm_score;
+	bool palm;
+	ktime_t last_time;
+
+	/* raw positions touched during a calibration capture */
+	u32 cal_hist[FJS_CAL_BINS];
+
+	/* packet storm detection and deferred processing */
+	unsigned long window_start;
+	unsigned int window_count;
+	unsigned int window_rate;
+	bool storm;
+	struct work_struct storm_work;
+	DECLARE_KFIFO(storm_fifo, struct fujitsu_scroll_packet,
+		      FJS_STORM_QUEUE);
+
+	struct fujitsu_scroll_stats stats;
+	struct dentry *debugfs;
 };
 
 void fujitsu_scroll_module_init(void);
+void fujitsu_scroll_module_exit(void);
 int fujitsu_scroll_detect(struct psmouse *psmouse, bool set_properties);
 int fujitsu_scroll_init(struct psmouse *psmouse);
 
+#else
+
+static inline void fujitsu_scroll_module_init(void)
+{
+}
+
+static inline void fujitsu_scroll_module_exit(void)
+{
+}
+
 #endif /* CONFIG_MOUSE_PS2_FUJITSU_SCROLL */
 
 #endif /* _FUJITSU_SCROLL_H */
@@ -18,8 +18,11 @@
 #include <linux/input.h>
 #include <linux/serio.h>
 #include <linux/init.h>
+#include <linux/ktime.h>
 #include <linux/libps2.h>
+#include <linux/list.h>
 #include <linux/mutex.h>
+#include <linux/spinlock.h>
 #include <linux/types.h>
 
 #include "psmouse.h"
@@ -115,6 +118,13 @@ ATTRIBUTE_GROUPS(psmouse_dev);
  */
 static DEFINE_MUTEX(psmouse_mutex);
 
+/*
+ * Connected ports, so protocols can see how busy the other ports behind
+ * the same controller (and sharing its interrupt) are.
+ */
+static DEFINE_SPINLOCK(psmouse_list_lock);
+static LIST_HEAD(psmouse_list);
+
 static struct workqueue_struct *kpsmoused_wq;
 
 struct psmouse *psmouse_from_serio(struct serio *serio)
@@ -248,6 +258,64 @@ void psmouse_queue_work(struct psmouse *psmouse, struct delayed_work *work,
 	queue_delayed_work(kpsmoused_wq, work, delay);
 }
 
+/*
+ * psmouse_trylock() and psmouse_unlock() let protocol work items take
+ * psmouse_mutex, to serialize against connect, disconnect, reconnect
+ * and the sysfs attributes.  Disconnect waits for such work with the
+ * mutex held, so it may only be tried; work that fails to get it
+ * requeues itself.
+ */
+bool psmouse_trylock(void)
+{
+	return mutex_trylock(&psmouse_mutex);
+}
+
+void psmouse_unlock(void)
+{
+	mutex_unlock(&psmouse_mutex);
+}
+
+/*
+ * psmouse_sibling_activity() returns when the last full packet of any
+ * other port behind the same controller arrived, 0 if none did.  Safe to
+ * call from the interrupt handler.
+ */
+ktime_t psmouse_sibling_activity(struct psmouse *psmouse)
+{
+	struct device *controller = psmouse->ps2dev.serio->dev.parent;
+	struct psmouse *other;
+	unsigned long flags;
+	ktime_t last = 0;
+
+	spin_lock_irqsave(&psmouse_list_lock, flags);
+	list_for_each_entry(other, &psmouse_list, node) {
+		if (other != psmouse &&
+		    other->ps2dev.serio->dev.parent == controller)
+			last = max(last, READ_ONCE(other->last_packet));
+	}
+	spin_unlock_irqrestore(&psmouse_list_lock, flags);
+
+	return last;
+}
+
+static void psmouse_list_add(struct psmouse *psmouse)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&psmouse_list_lock, flags);
+	list_add_tail(&psmouse->node, &psmouse_list);
+	spin_unlock_irqrestore(&psmouse_list_lock, flags);
+}
+
+static void psmouse_list_del(struct psmouse *psmouse)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&psmouse_list_lock, flags);
+	list_del(&psmouse->node);
+	spin_unlock_irqrestore(&psmouse_list_lock, flags);
+}
+
 /*
  * __psmouse_set_state() sets new psmouse state and resets all flags.
  */
@@ -271,6 +339,59 @@ void psmouse_set_state(struct psmouse *psmouse, enum psmouse_state new_state)
 	serio_continue_rx(psmouse->ps2dev.serio);
 }
 
+/*
+ * psmouse_record_byte() stores the byte in the history ring, hands the
+ * record to debugfs capture, if any, and notes when a packet started.
+ */
+static void psmouse_record_byte(struct psmouse *psmouse, u8 data,
+				unsigned int flags)
+{
+	struct psmouse_byte_record *rec;
+	u64 now = ktime_get_ns();
+
+	/* A byte arriving at packet position 0 may start a new packet */
+	if (!psmouse->pktcnt)
+		psmouse->packet_time = ns_to_ktime(now);
+
+	rec = psmouse_history_entry(psmouse, psmouse->history_head++);
+	rec->time_ns = cpu_to_le64(now);
+	rec->data = data;
+	rec->flags = flags;
+	rec->state = psmouse->state;
+	rec->pktcnt = psmouse->pktcnt;
+
+	psmouse_debugfs_capture(psmouse, rec);
+}
+
+/*
+ * psmouse_dump_history() logs the most recent bytes received from the
+ * device, oldest first, and keeps a timestamped copy for debugfs.  It
+ * must be called with the serio lock held (from the interrupt path or
+ * under serio_pause_rx()).
+ */
+static void psmouse_dump_history(struct psmouse *psmouse, const char *reason,
+				 bool log)
+{
+	const struct psmouse_byte_record *rec;
+	u8 bytes[PSMOUSE_HISTORY_SIZE];
+	unsigned int count, first, i;
+
+	count = min_t(unsigned int, psmouse->history_head,
+		      PSMOUSE_HISTORY_SIZE);
+	first = psmouse->history_head - count;
+
+	if (log && count) {
+		for (i = 0; i < count; i++) {
+			rec = psmouse_history_entry(psmouse, first + i);
+			bytes[i] = rec->data;
+		}
+		psmouse_warn(psmouse, "%s, last %u bytes: %*ph\n",
+			     reason, count, count, bytes);
+	}
+
+	psmouse_debugfs_snapshot(psmouse, reason);
+}
+
 /*
  * psmouse_handle_byte() processes one byte of the input data stream
  * by calling corresponding protocol handler.
@@ -287,6 +408,9 @@ static int psmouse_handle_byte(struct psmouse *psmouse)
 				     psmouse->name, psmouse->phys,
 				     psmouse->pktcnt);
 			if (++psmouse->out_of_sync_cnt == psmouse->resetafter) {
+				psmouse_dump_history(psmouse,
+						     "too many sync errors",
+						     true);
 				__psmouse_set_state(psmouse, PSMOUSE_IGNORE);
 				psmouse_notice(psmouse,
 						"issuing reconnect request\n");
@@ -299,6 +423,7 @@ static int psmouse_handle_byte(struct psmouse *psmouse)
 
 	case PSMOUSE_FULL_PACKET:
 		psmouse->pktcnt = 0;
+		WRITE_ONCE(psmouse->last_packet, psmouse->packet_time);
 		if (psmouse->out_of_sync_cnt) {
 			psmouse->out_of_sync_cnt = 0;
 			psmouse_notice(psmouse,
@@ -343,6 +468,8 @@ static enum ps2_disposition psmouse_pre_receive_byte(struct ps2dev *ps2dev,
 {
 	struct psmouse *psmouse = container_of(ps2dev, struct psmouse, ps2dev);
 
+	psmouse_record_byte(psmouse, data, flags);
+
 	if (psmouse->state == PSMOUSE_IGNORE)
 		return PS2_IGNORE;
 
@@ -379,6 +506,7 @@ static void psmouse_receive_byte(struct ps2dev *ps2dev, u8 data)
 	    psmouse->pktcnt && time_after(jiffies, psmouse->last + HZ/2)) {
 		psmouse_info(psmouse, "%s at %s lost synchronization, throwing %d bytes away.\n",
 			     psmouse->name, psmouse->phys, psmouse->pktcnt);
+		psmouse_dump_history(psmouse, "lost synchronization", true);
 		psmouse->badbyte = psmouse->packet[0];
 		__psmouse_set_state(psmouse, PSMOUSE_RESYNCING);
 		psmouse_queue_work(psmouse, &psmouse->resync_work, 0);
@@ -397,6 +525,8 @@ static void psmouse_receive_byte(struct ps2dev *ps2dev, u8 data)
 		if (psmouse->packet[1] == PSMOUSE_RET_ID ||
 		    (psmouse->protocol->type == PSMOUSE_HGPK &&
 		     psmouse->packet[1] == PSMOUSE_RET_BAT)) {
+			psmouse_dump_history(psmouse, "device announced BAT",
+					     true);
 			__psmouse_set_state(psmouse, PSMOUSE_IGNORE);
 			serio_reconnect(ps2dev->serio);
 			return;
@@ -427,6 +557,33 @@ static void psmouse_receive_byte(struct ps2dev *ps2dev, u8 data)
 	psmouse_handle_byte(psmouse);
 }
 
+/*
+ * psmouse_command() and psmouse_sliced_command() are ps2_command() and
+ * ps2_sliced_command() with the time spent waiting for the device (and
+ * the way it failed, if it did) recorded in debugfs.
+ */
+int psmouse_command(struct psmouse *psmouse, u8 *param, unsigned int command)
+{
+	ktime_t start = ktime_get();
+	int error;
+
+	error = ps2_command(&psmouse->ps2dev, param, command);
+	psmouse_debugfs_command(psmouse, command, start, error);
+
+	return error;
+}
+
+int psmouse_sliced_command(struct psmouse *psmouse, u8 command)
+{
+	ktime_t start = ktime_get();
+	int error;
+
+	error = ps2_sliced_command(&psmouse->ps2dev, command);
+	psmouse_debugfs_command(psmouse, PSMOUSE_CMD_SLICED, start, error);
+
+	return error;
+}
+
 /*
  * psmouse_reset() resets the mouse into power-on state.
  */
@@ -435,7 +592,7 @@ int psmouse_reset(struct psmouse *psmouse)
 	u8 param[2];
 	int error;
 
-	error = ps2_command(&psmouse->ps2dev, param, PSMOUSE_CMD_RESET_BAT);
+	error = psmouse_command(psmouse, param, PSMOUSE_CMD_RESET_BAT);
 	if (error)
 		return error;
 
@@ -457,7 +614,7 @@ void psmouse_set_resolution(struct psmouse *psmouse, unsigned int resolution)
 		resolution = 200;
 
 	p = params[resolution / 50];
-	ps2_command(&psmouse->ps2dev, &p, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, &p, PSMOUSE_CMD_SETRES);
 	psmouse->resolution = 25 << p;
 }
 
@@ -473,7 +630,7 @@ static void psmouse_set_rate(struct psmouse *psmouse, unsigned int rate)
 	while (rates[i] > rate)
 		i++;
 	r = rates[i];
-	ps2_command(&psmouse->ps2dev, &r, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, &r, PSMOUSE_CMD_SETRATE);
 	psmouse->rate = r;
 }
 
@@ -482,9 +639,9 @@ static void psmouse_set_rate(struct psmouse *psmouse, unsigned int rate)
  */
 static void psmouse_set_scale(struct psmouse *psmouse, enum psmouse_scale scale)
 {
-	ps2_command(&psmouse->ps2dev, NULL,
-		    scale == PSMOUSE_SCALE21 ? PSMOUSE_CMD_SETSCALE21 :
-					       PSMOUSE_CMD_SETSCALE11);
+	psmouse_command(psmouse, NULL,
+			scale == PSMOUSE_SCALE21 ? PSMOUSE_CMD_SETSCALE21 :
+						   PSMOUSE_CMD_SETSCALE11);
 }
 
 /*
@@ -492,8 +649,8 @@ static void psmouse_set_scale(struct psmouse *psmouse, enum psmouse_scale scale)
  */
 static int psmouse_poll(struct psmouse *psmouse)
 {
-	return ps2_command(&psmouse->ps2dev, psmouse->packet,
-			   PSMOUSE_CMD_POLL | (psmouse->pktsize << 8));
+	return psmouse_command(psmouse, psmouse->packet,
+			       PSMOUSE_CMD_POLL | (psmouse->pktsize << 8));
 }
 
 static bool psmouse_check_pnp_id(const char *id, const char * const ids[])
@@ -542,15 +699,14 @@ bool psmouse_matches_pnp_id(struct psmouse *psmouse, const char * const ids[])
  */
 static int genius_detect(struct psmouse *psmouse, bool set_properties)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	u8 param[4];
 
 	param[0] = 3;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
-	ps2_command(ps2dev,  NULL, PSMOUSE_CMD_SETSCALE11);
-	ps2_command(ps2dev,  NULL, PSMOUSE_CMD_SETSCALE11);
-	ps2_command(ps2dev,  NULL, PSMOUSE_CMD_SETSCALE11);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETINFO);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_SETSCALE11);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_SETSCALE11);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_SETSCALE11);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETINFO);
 
 	if (param[0] != 0x00 || param[1] != 0x33 || param[2] != 0x55)
 		return -ENODEV;
@@ -574,16 +730,15 @@ static int genius_detect(struct psmouse *psmouse, bool set_properties)
  */
 static int intellimouse_detect(struct psmouse *psmouse, bool set_properties)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	u8 param[2];
 
 	param[0] = 200;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] = 100;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] =  80;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETID);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETID);
 
 	if (param[0] != 3)
 		return -ENODEV;
@@ -607,29 +762,28 @@ static int intellimouse_detect(struct psmouse *psmouse, bool set_properties)
  */
 static int im_explorer_detect(struct psmouse *psmouse, bool set_properties)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	u8 param[2];
 
 	intellimouse_detect(psmouse, 0);
 
 	param[0] = 200;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] = 200;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] =  80;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETID);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETID);
 
 	if (param[0] != 4)
 		return -ENODEV;
 
 	/* Magic to enable horizontal scrolling on IntelliMouse 4.0 */
 	param[0] = 200;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] =  80;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] =  40;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 
 	if (set_properties) {
 		__set_bit(BTN_MIDDLE, psmouse->dev->keybit);
@@ -653,20 +807,19 @@ static int im_explorer_detect(struct psmouse *psmouse, bool set_properties)
  */
 static int thinking_detect(struct psmouse *psmouse, bool set_properties)
 {
-	struct ps2dev *ps2dev = &psmouse->ps2dev;
 	u8 param[2];
 	static const u8 seq[] = { 20, 60, 40, 20, 20, 60, 40, 20, 20 };
 	int i;
 
 	param[0] = 10;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	param[0] = 0;
-	ps2_command(ps2dev, param, PSMOUSE_CMD_SETRES);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_SETRES);
 	for (i = 0; i < ARRAY_SIZE(seq); i++) {
 		param[0] = seq[i];
-		ps2_command(ps2dev, param, PSMOUSE_CMD_SETRATE);
+		psmouse_command(psmouse, param, PSMOUSE_CMD_SETRATE);
 	}
-	ps2_command(ps2dev, param, PSMOUSE_CMD_GETID);
+	psmouse_command(psmouse, param, PSMOUSE_CMD_GETID);
 
 	if (param[0] != 2)
 		return -ENODEV;
@@ -999,6 +1152,36 @@ static void psmouse_apply_defaults(struct psmouse *psmouse)
 	psmouse->cleanup = NULL;
 	psmouse->pt_activate = NULL;
 	psmouse->pt_deactivate = NULL;
+	psmouse->input_elsewhere = false;
+}
+
+/*
+ * Protocol detect and init routines run through these so that the time
+ * each of them takes on a given port shows up in debugfs.
+ */
+static int psmouse_timed_detect(struct psmouse *psmouse,
+				int (*detect)(struct psmouse *, bool),
+				bool set_properties)
+{
+	ktime_t start = ktime_get();
+	int error;
+
+	error = detect(psmouse, set_properties);
+	psmouse_debugfs_probe(psmouse, detect, start, error);
+
+	return error;
+}
+
+static int psmouse_timed_init(struct psmouse *psmouse,
+			      int (*init)(struct psmouse *))
+{
+	ktime_t start = ktime_get();
+	int error;
+
+	error = init(psmouse);
+	psmouse_debugfs_probe(psmouse, init, start, error);
+
+	return error;
 }
 
 static bool psmouse_do_detect(int (*detect)(struct psmouse *, bool),
@@ -1013,7 +1196,7 @@ static bool psmouse_do_detect(int (*detect)(struct psmouse *, bool),
 	if (set_properties)
 		psmouse_apply_defaults(psmouse);
 
-	return detect(psmouse, set_properties) == 0;
+	return psmouse_timed_detect(psmouse, detect, set_properties) == 0;
 }
 
 static bool psmouse_try_protocol(struct psmouse *psmouse,
@@ -1032,7 +1215,7 @@ static bool psmouse_try_protocol(struct psmouse *psmouse,
 		return false;
 
 	if (set_properties && proto->init && init_allowed) {
-		if (proto->init(psmouse) != 0) {
+		if (psmouse_timed_init(psmouse, proto->init) != 0) {
 			/*
 			 * We detected device, but init failed. Adjust
 			 * max_proto so we only try standard protocols.
@@ -1065,7 +1248,8 @@ static int psmouse_extensions(struct psmouse *psmouse,
 			      psmouse, false, set_properties)) {
 		if (max_proto > PSMOUSE_IMEX &&
 		    IS_ENABLED(CONFIG_MOUSE_PS2_FOCALTECH) &&
-		    (!set_properties || focaltech_init(psmouse) == 0)) {
+		    (!set_properties ||
+		     psmouse_timed_init(psmouse, focaltech_init) == 0)) {
 			return PSMOUSE_FOCALTECH;
 		}
 		/*
@@ -1134,7 +1318,8 @@ static int psmouse_extensions(struct psmouse *psmouse,
 				if (!set_properties)
 					return PSMOUSE_SYNAPTICS;
 
-				ret = synaptics_init(psmouse);
+				ret = psmouse_timed_init(psmouse,
+							 synaptics_init);
 				if (ret >= 0)
 					return ret;
 			}
@@ -1168,7 +1353,7 @@ static int psmouse_extensions(struct psmouse *psmouse,
 
 	/* Try ALPS TouchPad */
 	if (max_proto > PSMOUSE_IMEX) {
-		ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_RESET_DIS);
+		psmouse_command(psmouse, NULL, PSMOUSE_CMD_RESET_DIS);
 		if (psmouse_try_protocol(psmouse, PSMOUSE_ALPS,
 					 &max_proto, set_properties, true))
 			return PSMOUSE_ALPS;
@@ -1188,7 +1373,7 @@ static int psmouse_extensions(struct psmouse *psmouse,
 		if (!set_properties)
 			return PSMOUSE_ELANTECH;
 
-		ret = elantech_init(psmouse);
+		ret = psmouse_timed_init(psmouse, elantech_init);
 		if (ret >= 0)
 			return ret;
 	}
@@ -1226,7 +1411,7 @@ static int psmouse_extensions(struct psmouse *psmouse,
 	 * protocol probes. Note that we follow up with full reset because
 	 * some mice put themselves to sleep when they see PSMOUSE_RESET_DIS.
 	 */
-	ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_RESET_DIS);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_RESET_DIS);
 	psmouse_reset(psmouse);
 
 	if (max_proto >= PSMOUSE_IMEX &&
@@ -1277,7 +1462,7 @@ static int psmouse_probe(struct psmouse *psmouse)
 	 * subsequent ID queries, probably due to a firmware bug.
 	 */
 	param[0] = 0xa5;
-	error = ps2_command(ps2dev, param, PSMOUSE_CMD_GETID);
+	error = psmouse_command(psmouse, param, PSMOUSE_CMD_GETID);
 	if (error)
 		return error;
 
@@ -1289,7 +1474,7 @@ static int psmouse_probe(struct psmouse *psmouse)
 	 * Then we reset and disable the mouse so that it doesn't generate
 	 * events.
 	 */
-	error = ps2_command(ps2dev, NULL, PSMOUSE_CMD_RESET_DIS);
+	error = psmouse_command(psmouse, NULL, PSMOUSE_CMD_RESET_DIS);
 	if (error)
 		psmouse_warn(psmouse, "Failed to reset mouse on %s: %d\n",
 			     ps2dev->serio->phys, error);
@@ -1317,7 +1502,7 @@ static void psmouse_initialize(struct psmouse *psmouse)
  */
 int psmouse_activate(struct psmouse *psmouse)
 {
-	if (ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_ENABLE)) {
+	if (psmouse_command(psmouse, NULL, PSMOUSE_CMD_ENABLE)) {
 		psmouse_warn(psmouse, "Failed to enable mouse on %s\n",
 			     psmouse->ps2dev.serio->phys);
 		return -1;
@@ -1335,7 +1520,7 @@ int psmouse_deactivate(struct psmouse *psmouse)
 {
 	int error;
 
-	error = ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_DISABLE);
+	error = psmouse_command(psmouse, NULL, PSMOUSE_CMD_DISABLE);
 	if (error) {
 		psmouse_warn(psmouse, "Failed to deactivate mouse on %s: %d\n",
 			     psmouse->ps2dev.serio->phys, error);
@@ -1416,7 +1601,7 @@ static void psmouse_resync(struct work_struct *work)
 	 * out with disabled mouse.
 	 */
 	for (i = 0; i < 5; i++) {
-		if (!ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_ENABLE)) {
+		if (!psmouse_command(psmouse, NULL, PSMOUSE_CMD_ENABLE)) {
 			enabled = true;
 			break;
 		}
@@ -1463,7 +1648,7 @@ static void psmouse_cleanup(struct serio *serio)
 	/*
 	 * Disable stream mode so cleanup routine can proceed undisturbed.
 	 */
-	if (ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_DISABLE))
+	if (psmouse_command(psmouse, NULL, PSMOUSE_CMD_DISABLE))
 		psmouse_warn(psmouse, "Failed to disable mouse on %s\n",
 			     psmouse->ps2dev.serio->phys);
 
@@ -1473,13 +1658,13 @@ static void psmouse_cleanup(struct serio *serio)
 	/*
 	 * Reset the mouse to defaults (bare PS/2 protocol).
 	 */
-	ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_RESET_DIS);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_RESET_DIS);
 
 	/*
 	 * Some boxes, such as HP nx7400, get terribly confused if mouse
 	 * is not fully enabled before suspending/shutting down.
 	 */
-	ps2_command(&psmouse->ps2dev, NULL, PSMOUSE_CMD_ENABLE);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_ENABLE);
 
 	if (parent) {
 		if (parent->pt_deactivate)
@@ -1501,6 +1686,7 @@ static void psmouse_disconnect(struct serio *serio)
 
 	mutex_lock(&psmouse_mutex);
 
+	psmouse_list_del(psmouse);
 	psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
 
 	/* make sure we don't have a resync in progress */
@@ -1527,6 +1713,7 @@ static void psmouse_disconnect(struct serio *serio)
 	if (psmouse->dev)
 		input_unregister_device(psmouse->dev);
 
+	psmouse_debugfs_cleanup(psmouse);
 	kfree(psmouse);
 
 	if (parent)
@@ -1541,21 +1728,25 @@ static int psmouse_switch_protocol(struct psmouse *psmouse,
 	const struct psmouse_protocol *selected_proto;
 	struct input_dev *input_dev = psmouse->dev;
 	enum psmouse_type type;
+	ktime_t start;
 
 	input_dev->dev.parent = &psmouse->ps2dev.serio->dev;
 
 	if (proto && (proto->detect || proto->init)) {
 		psmouse_apply_defaults(psmouse);
 
-		if (proto->detect && proto->detect(psmouse, true) < 0)
+		if (proto->detect &&
+		    psmouse_timed_detect(psmouse, proto->detect, true) < 0)
 			return -1;
 
-		if (proto->init && proto->init(psmouse) < 0)
+		if (proto->init && psmouse_timed_init(psmouse, proto->init) < 0)
 			return -1;
 
 		selected_proto = proto;
 	} else {
+		start = ktime_get();
 		type = psmouse_extensions(psmouse, psmouse_max_proto, true);
+		psmouse_debugfs_probe(psmouse, psmouse_extensions, start, type);
 		selected_proto = psmouse_protocol_by_type(type);
 	}
 
@@ -1599,6 +1790,7 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 {
 	struct psmouse *psmouse, *parent = NULL;
 	struct input_dev *input_dev;
+	ktime_t start = ktime_get();
 	int retval = 0, error = -ENOMEM;
 
 	mutex_lock(&psmouse_mutex);
@@ -1623,6 +1815,8 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 	psmouse->dev = input_dev;
 	snprintf(psmouse->phys, sizeof(psmouse->phys), "%s/input0", serio->phys);
 
+	psmouse_debugfs_init(psmouse);
+
 	psmouse_set_state(psmouse, PSMOUSE_INITIALIZING);
 
 	error = serio_open(serio, drv);
@@ -1649,19 +1843,26 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 	if (!psmouse->protocol->smbus_companion) {
 		psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
 		psmouse_initialize(psmouse);
+	}
 
+	if (psmouse->protocol->smbus_companion || psmouse->input_elsewhere) {
+		/*
+		 * Smbus companion, or an input device set up by the
+		 * protocol, will be reporting events, not us.
+		 */
+		input_free_device(input_dev);
+		psmouse->dev = input_dev = NULL;
+	} else {
 		error = input_register_device(input_dev);
 		if (error)
 			goto err_protocol_disconnect;
-	} else {
-		/* Smbus companion will be reporting events, not us. */
-		input_free_device(input_dev);
-		psmouse->dev = input_dev = NULL;
 	}
 
 	if (parent && parent->pt_activate)
 		parent->pt_activate(parent);
 
+	psmouse_list_add(psmouse);
+
 	/*
 	 * PS/2 devices having SMBus companions should stay disabled
 	 * on PS/2 side, in order to have SMBus part operable.
@@ -1669,6 +1870,8 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
 	if (!psmouse->protocol->smbus_companion)
 		psmouse_activate(psmouse);
 
+	psmouse_debugfs_probe(psmouse, psmouse_connect, start, 0);
+
  out:
 	/* If this is a pass-through port the parent needs to be re-activated */
 	if (parent)
@@ -1686,6 +1889,8 @@ static int psmouse_connect(struct serio *serio, struct serio_driver *drv)
  err_clear_drvdata:
 	serio_set_drvdata(serio, NULL);
  err_free:
+	if (psmouse)
+		psmouse_debugfs_cleanup(psmouse);
 	input_free_device(input_dev);
 	kfree(psmouse);
 
@@ -1699,6 +1904,7 @@ static int __psmouse_reconnect(struct serio *serio, bool fast_reconnect)
 	struct psmouse *parent = NULL;
 	int (*reconnect_handler)(struct psmouse *);
 	enum psmouse_type type;
+	ktime_t start = ktime_get(), probe_start;
 	int rc = -1;
 
 	mutex_lock(&psmouse_mutex);
@@ -1718,10 +1924,14 @@ static int __psmouse_reconnect(struct serio *serio, bool fast_reconnect)
 		psmouse_deactivate(parent);
 	}
 
+	serio_pause_rx(serio);
+	psmouse_dump_history(psmouse, "reconnect", false);
+	serio_continue_rx(serio);
+
 	psmouse_set_state(psmouse, PSMOUSE_INITIALIZING);
 
 	if (reconnect_handler) {
-		if (reconnect_handler(psmouse))
+		if (psmouse_timed_init(psmouse, reconnect_handler))
 			goto out;
 	} else {
 		psmouse_reset(psmouse);
@@ -1729,7 +1939,10 @@ static int __psmouse_reconnect(struct serio *serio, bool fast_reconnect)
 		if (psmouse_probe(psmouse) < 0)
 			goto out;
 
+		probe_start = ktime_get();
 		type = psmouse_extensions(psmouse, psmouse_max_proto, false);
+		psmouse_debugfs_probe(psmouse, psmouse_extensions,
+				      probe_start, type);
 		if (psmouse->protocol->type != type)
 			goto out;
 	}
@@ -1760,6 +1973,8 @@ out:
 	if (parent)
 		psmouse_activate(parent);
 
+	psmouse_debugfs_probe(psmouse, __psmouse_reconnect, start, rc);
+
 out_unlock:
 	mutex_unlock(&psmouse_mutex);
 	return rc;
@@ -1969,7 +2184,7 @@ static ssize_t psmouse_attr_set_protocol(struct psmouse *psmouse, void *data, co
 	psmouse_initialize(psmouse);
 	psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
 
-	if (psmouse->protocol->smbus_companion) {
+	if (psmouse->protocol->smbus_companion || psmouse->input_elsewhere) {
 		input_free_device(psmouse->dev);
 		psmouse->dev = NULL;
 	} else {
@@ -2062,6 +2277,9 @@ static int __init psmouse_init(void)
 	if (err)
 		return err;
 
+	psmouse_debugfs_module_init();
+	fujitsu_scroll_module_init();
+
 	kpsmoused_wq = alloc_ordered_workqueue("kpsmoused", 0);
 	if (!kpsmoused_wq) {
 		pr_err("failed to create kpsmoused workqueue\n");
@@ -2078,6 +2296,8 @@ static int __init psmouse_init(void)
 err_destroy_wq:
 	destroy_workqueue(kpsmoused_wq);
 err_smbus_exit:
+	fujitsu_scroll_module_exit();
+	psmouse_debugfs_module_exit();
 	psmouse_smbus_module_exit();
 	return err;
 }
@@ -2086,6 +2306,8 @@ static void __exit psmouse_exit(void)
 {
 	serio_unregister_driver(&psmouse_drv);
 	destroy_workqueue(kpsmoused_wq);
+	fujitsu_scroll_module_exit();
+	psmouse_debugfs_module_exit();
 	psmouse_smbus_module_exit();
 }
 
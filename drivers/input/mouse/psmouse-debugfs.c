@@ -0,0 +1,583 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * PS/2 mouse driver - debugfs interface
+ *
+ * Every psmouse port gets a directory under /sys/kernel/debug/psmouse/,
+ * named after its serio port, holding the following files:
+ *
+ *   capture_size - number of records the capture buffer holds; writing a
+ *                  non-zero value (re)starts capturing, 0 stops it
+ *   capture      - reading drains the captured bytes as a sequence of
+ *                  struct psmouse_byte_record
+ *   history      - the last PSMOUSE_HISTORY_SIZE bytes as they were when
+ *                  the port last lost sync, saw a BAT or was reconnected;
+ *                  raw bytes only, decoding them is up to the reader
+ *   timing       - how long each PS/2 command took to complete (count,
+ *                  average and worst time, ACK timeouts, NAKs and other
+ *                  errors) and how long each detect, init and reconnect
+ *                  routine, psmouse_extensions() and psmouse_connect()
+ *                  took on this port
+ *
+ * When the module is loaded with inject=1 there are also:
+ *
+ *   inject       - bytes written here are fed to the port through
+ *                  serio_interrupt(), exactly as if the KBC had sent them
+ *   inject_delay_us - pause between injected packets (pktsize bytes)
+ *   inject_stats - number of injected packets and the time spent
+ *                  handling them (total and worst case, in ns)
+ */
+
+#define psmouse_fmt(fmt)	fmt
+
+#include <linux/capability.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/fs.h>
+#include <linux/kfifo.h>
+#include <linux/ktime.h>
+#include <linux/libps2.h>
+#include <linux/math64.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/sched/signal.h>
+#include <linux/seq_file.h>
+#include <linux/serio.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/uaccess.h>
+
+#include "psmouse.h"
+
+#define PSMOUSE_TIMED_COMMANDS	24
+#define PSMOUSE_TIMED_PROBES	32
+
+struct psmouse_command_timing {
+	unsigned int command;
+	unsigned long count;
+	unsigned long timeouts;		/* no ACK in time (-EIO) */
+	unsigned long naks;		/* -EAGAIN */
+	unsigned long errors;		/* short response and the rest */
+	u64 total_us;
+	u32 max_us;
+};
+
+struct psmouse_probe_timing {
+	const void *fn;
+	unsigned long count;
+	int result;
+	u32 last_us;
+	u32 max_us;
+	u64 total_us;
+};
+
+struct psmouse_debug {
+	struct dentry *dir;
+
+	/*
+	 * The capture buffer is filled from the interrupt handler and
+	 * drained by readers; capture_mutex serializes readers against
+	 * each other and against resizing.
+	 */
+	struct mutex capture_mutex;
+	DECLARE_KFIFO_PTR(capture, struct psmouse_byte_record);
+	unsigned int capture_size;
+	bool capturing;
+	unsigned long capture_lost;
+
+	/* Written and read with the serio lock held */
+	struct psmouse_byte_record snapshot[PSMOUSE_HISTORY_SIZE];
+	unsigned int snapshot_len;
+	const char *snapshot_reason;
+	unsigned long snapshot_count;
+
+	struct mutex inject_mutex;
+	u32 inject_delay_us;
+	unsigned long inject_packets;
+	u64 inject_total_ns;
+	u64 inject_max_ns;
+
+	/*
+	 * Commands may be issued from process context concurrently (sysfs,
+	 * resync and protocol work), so the tables have a lock of their own.
+	 */
+	spinlock_t timing_lock;
+	struct psmouse_command_timing commands[PSMOUSE_TIMED_COMMANDS];
+	unsigned int num_commands;
+	struct psmouse_probe_timing probes[PSMOUSE_TIMED_PROBES];
+	unsigned int num_probes;
+	unsigned long timing_lost;
+};
+
+static struct dentry *psmouse_debugfs_root;
+
+static bool psmouse_debugfs_inject;
+module_param_named(inject, psmouse_debugfs_inject, bool, 0444);
+MODULE_PARM_DESC(inject, "Allow feeding bytes to ports through debugfs (benchmarking/testing only).");
+
+void psmouse_debugfs_capture(struct psmouse *psmouse,
+			     const struct psmouse_byte_record *rec)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+
+	if (!debug || !debug->capturing)
+		return;
+
+	if (!kfifo_put(&debug->capture, *rec))
+		debug->capture_lost++;
+}
+
+void psmouse_debugfs_snapshot(struct psmouse *psmouse, const char *reason)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+	unsigned int count, first, i;
+
+	if (!debug)
+		return;
+
+	count = min_t(unsigned int, psmouse->history_head,
+		      PSMOUSE_HISTORY_SIZE);
+	first = psmouse->history_head - count;
+
+	for (i = 0; i < count; i++)
+		debug->snapshot[i] = *psmouse_history_entry(psmouse, first + i);
+	debug->snapshot_len = count;
+	debug->snapshot_reason = reason;
+	debug->snapshot_count++;
+}
+
+static int psmouse_debugfs_history_show(struct seq_file *s, void *unused)
+{
+	struct psmouse *psmouse = s->private;
+	struct psmouse_debug *debug = psmouse->debug;
+	struct serio *serio = psmouse->ps2dev.serio;
+	const struct psmouse_byte_record *rec;
+	unsigned int len, i;
+	u64 last;
+
+	serio_pause_rx(serio);
+
+	len = debug->snapshot_len;
+	if (len) {
+		seq_printf(s, "%s (snapshot %lu)\n",
+			   debug->snapshot_reason, debug->snapshot_count);
+
+		/* Times are relative to the most recent byte */
+		last = le64_to_cpu(debug->snapshot[len - 1].time_ns);
+		for (i = 0; i < len; i++) {
+			rec = &debug->snapshot[i];
+			seq_printf(s,
+				   "-%8lluus %02x flags %02x state %u pkt %u\n",
+				   div_u64(last - le64_to_cpu(rec->time_ns),
+					   NSEC_PER_USEC),
+				   rec->data, rec->flags,
+				   rec->state, rec->pktcnt);
+		}
+	}
+
+	serio_continue_rx(serio);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(psmouse_debugfs_history);
+
+static u32 psmouse_debugfs_elapsed_us(ktime_t start)
+{
+	return min_t(s64, ktime_us_delta(ktime_get(), start), U32_MAX);
+}
+
+void psmouse_debugfs_command(struct psmouse *psmouse, unsigned int command,
+			     ktime_t start, int error)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+	struct psmouse_command_timing *t = NULL;
+	u32 us = psmouse_debugfs_elapsed_us(start);
+	unsigned long flags;
+	unsigned int i;
+
+	if (!debug)
+		return;
+
+	spin_lock_irqsave(&debug->timing_lock, flags);
+
+	for (i = 0; i < debug->num_commands; i++) {
+		if (debug->commands[i].command == command) {
+			t = &debug->commands[i];
+			break;
+		}
+	}
+
+	if (!t && debug->num_commands < PSMOUSE_TIMED_COMMANDS) {
+		t = &debug->commands[debug->num_commands++];
+		t->command = command;
+	}
+
+	if (t) {
+		t->count++;
+		t->total_us += us;
+		t->max_us = max(t->max_us, us);
+		if (error == -EIO)
+			t->timeouts++;
+		else if (error == -EAGAIN)
+			t->naks++;
+		else if (error)
+			t->errors++;
+	} else {
+		debug->timing_lost++;
+	}
+
+	spin_unlock_irqrestore(&debug->timing_lock, flags);
+}
+
+void psmouse_debugfs_probe(struct psmouse *psmouse, const void *fn,
+			   ktime_t start, int result)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+	struct psmouse_probe_timing *t = NULL;
+	u32 us = psmouse_debugfs_elapsed_us(start);
+	unsigned long flags;
+	unsigned int i;
+
+	if (!debug)
+		return;
+
+	spin_lock_irqsave(&debug->timing_lock, flags);
+
+	for (i = 0; i < debug->num_probes; i++) {
+		if (debug->probes[i].fn == fn) {
+			t = &debug->probes[i];
+			break;
+		}
+	}
+
+	if (!t && debug->num_probes < PSMOUSE_TIMED_PROBES) {
+		t = &debug->probes[debug->num_probes++];
+		t->fn = fn;
+	}
+
+	if (t) {
+		t->count++;
+		t->result = result;
+		t->last_us = us;
+		t->total_us += us;
+		t->max_us = max(t->max_us, us);
+	} else {
+		debug->timing_lost++;
+	}
+
+	spin_unlock_irqrestore(&debug->timing_lock, flags);
+}
+
+static int psmouse_debugfs_timing_show(struct seq_file *s, void *unused)
+{
+	struct psmouse *psmouse = s->private;
+	struct psmouse_debug *debug = psmouse->debug;
+	const struct psmouse_command_timing *c;
+	const struct psmouse_probe_timing *p;
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&debug->timing_lock, flags);
+
+	seq_puts(s, "command  count    avg_us   max_us timeouts naks errors\n");
+	for (i = 0; i < debug->num_commands; i++) {
+		c = &debug->commands[i];
+		if (c->command == PSMOUSE_CMD_SLICED)
+			seq_puts(s, "sliced ");
+		else
+			seq_printf(s, "0x%04x ", c->command);
+		seq_printf(s, "%7lu %9llu %8u %8lu %4lu %6lu\n",
+			   c->count, div_u64(c->total_us, c->count),
+			   c->max_us, c->timeouts, c->naks, c->errors);
+	}
+
+	seq_puts(s, "\nroutine: count, last_us, avg_us, max_us, last result\n");
+	for (i = 0; i < debug->num_probes; i++) {
+		p = &debug->probes[i];
+		seq_printf(s, "%ps: %lu %u %llu %u %d\n",
+			   p->fn, p->count, p->last_us,
+			   div_u64(p->total_us, p->count),
+			   p->max_us, p->result);
+	}
+
+	if (debug->timing_lost)
+		seq_printf(s, "\nnot recorded (tables full): %lu\n",
+			   debug->timing_lost);
+
+	spin_unlock_irqrestore(&debug->timing_lock, flags);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(psmouse_debugfs_timing);
+
+static void psmouse_debugfs_stop_capture(struct psmouse *psmouse)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+	struct serio *serio = psmouse->ps2dev.serio;
+
+	serio_pause_rx(serio);
+	debug->capturing = false;
+	serio_continue_rx(serio);
+
+	kfifo_free(&debug->capture);
+	debug->capture_size = 0;
+}
+
+static ssize_t psmouse_debugfs_capture_read(struct file *file,
+					    char __user *buf,
+					    size_t count, loff_t *ppos)
+{
+	struct psmouse *psmouse = file->private_data;
+	struct psmouse_debug *debug = psmouse->debug;
+	unsigned int copied = 0;
+	int error;
+
+	error = mutex_lock_interruptible(&debug->capture_mutex);
+	if (error)
+		return error;
+
+	if (debug->capture_size)
+		error = kfifo_to_user(&debug->capture, buf, count, &copied);
+
+	mutex_unlock(&debug->capture_mutex);
+
+	return error ?: copied;
+}
+
+static const struct file_operations psmouse_debugfs_capture_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= psmouse_debugfs_capture_read,
+};
+
+static ssize_t psmouse_debugfs_capture_size_read(struct file *file,
+						 char __user *buf,
+						 size_t count, loff_t *ppos)
+{
+	struct psmouse *psmouse = file->private_data;
+	struct psmouse_debug *debug = psmouse->debug;
+	char tmp[48];
+	int len;
+
+	len = scnprintf(tmp, sizeof(tmp), "%u (lost %lu)\n",
+			READ_ONCE(debug->capture_size),
+			READ_ONCE(debug->capture_lost));
+
+	return simple_read_from_buffer(buf, count, ppos, tmp, len);
+}
+
+static ssize_t psmouse_debugfs_capture_size_write(struct file *file,
+						  const char __user *buf,
+						  size_t count, loff_t *ppos)
+{
+	struct psmouse *psmouse = file->private_data;
+	struct psmouse_debug *debug = psmouse->debug;
+	struct serio *serio = psmouse->ps2dev.serio;
+	unsigned int size;
+	int error;
+
+	error = kstrtouint_from_user(buf, count, 0, &size);
+	if (error)
+		return error;
+
+	if (size > PSMOUSE_CAPTURE_MAX)
+		return -EINVAL;
+
+	error = mutex_lock_interruptible(&debug->capture_mutex);
+	if (error)
+		return error;
+
+	if (debug->capture_size)
+		psmouse_debugfs_stop_capture(psmouse);
+
+	if (size) {
+		error = kfifo_alloc(&debug->capture, size, GFP_KERNEL);
+		if (!error) {
+			debug->capture_size = kfifo_size(&debug->capture);
+			debug->capture_lost = 0;
+
+			serio_pause_rx(serio);
+			debug->capturing = true;
+			serio_continue_rx(serio);
+		}
+	}
+
+	mutex_unlock(&debug->capture_mutex);
+
+	return error ?: count;
+}
+
+static const struct file_operations psmouse_debugfs_capture_size_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.read	= psmouse_debugfs_capture_size_read,
+	.write	= psmouse_debugfs_capture_size_write,
+};
+
+#define PSMOUSE_INJECT_CHUNK	64
+
+static ssize_t psmouse_debugfs_inject_write(struct file *file,
+					    const char __user *buf,
+					    size_t count, loff_t *ppos)
+{
+	struct psmouse *psmouse = file->private_data;
+	struct psmouse_debug *debug = psmouse->debug;
+	struct serio *serio = psmouse->ps2dev.serio;
+	u8 chunk[PSMOUSE_INJECT_CHUNK];
+	unsigned int pktpos = 0;
+	size_t done = 0;
+	u64 start = 0, elapsed;
+	size_t len, i;
+	int error;
+
+	if (!capable(CAP_SYS_RAWIO))
+		return -EPERM;
+
+	error = mutex_lock_interruptible(&debug->inject_mutex);
+	if (error)
+		return error;
+
+	while (done < count) {
+		len = min_t(size_t, count - done, sizeof(chunk));
+		if (copy_from_user(chunk, buf + done, len)) {
+			error = -EFAULT;
+			break;
+		}
+
+		for (i = 0; i < len; i++) {
+			if (pktpos == 0)
+				start = ktime_get_ns();
+
+			serio_interrupt(serio, chunk[i], 0);
+
+			/*
+			 * Packet boundaries are counted from the start of
+			 * the write; psmouse->pktsize may change under us if
+			 * the stream makes the port resync, which is fine
+			 * for timing purposes.
+			 */
+			if (++pktpos < max_t(unsigned int, psmouse->pktsize, 1))
+				continue;
+
+			pktpos = 0;
+			elapsed = ktime_get_ns() - start;
+			debug->inject_packets++;
+			debug->inject_total_ns += elapsed;
+			debug->inject_max_ns = max(debug->inject_max_ns,
+						   elapsed);
+
+			if (debug->inject_delay_us)
+				usleep_range(debug->inject_delay_us,
+					     debug->inject_delay_us + 10);
+		}
+
+		done += len;
+
+		/* Do not hold up disconnect or protocol change */
+		if (psmouse->state == PSMOUSE_IGNORE) {
+			error = -ENODEV;
+			break;
+		}
+
+		if (fatal_signal_pending(current)) {
+			error = -EINTR;
+			break;
+		}
+		cond_resched();
+	}
+
+	mutex_unlock(&debug->inject_mutex);
+
+	return done ?: error;
+}
+
+static const struct file_operations psmouse_debugfs_inject_fops = {
+	.owner	= THIS_MODULE,
+	.open	= simple_open,
+	.write	= psmouse_debugfs_inject_write,
+};
+
+static int psmouse_debugfs_inject_stats_show(struct seq_file *s, void *unused)
+{
+	struct psmouse *psmouse = s->private;
+	struct psmouse_debug *debug = psmouse->debug;
+
+	mutex_lock(&debug->inject_mutex);
+	seq_printf(s, "packets:\t%lu\n", debug->inject_packets);
+	seq_printf(s, "total_ns:\t%llu\n", debug->inject_total_ns);
+	seq_printf(s, "max_ns:\t\t%llu\n", debug->inject_max_ns);
+	mutex_unlock(&debug->inject_mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(psmouse_debugfs_inject_stats);
+
+static void psmouse_debugfs_init_inject(struct psmouse *psmouse)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+
+	mutex_init(&debug->inject_mutex);
+
+	if (!psmouse_debugfs_inject)
+		return;
+
+	debugfs_create_file("inject", 0200, debug->dir, psmouse,
+			    &psmouse_debugfs_inject_fops);
+	debugfs_create_u32("inject_delay_us", 0600, debug->dir,
+			   &debug->inject_delay_us);
+	debugfs_create_file("inject_stats", 0400, debug->dir, psmouse,
+			    &psmouse_debugfs_inject_stats_fops);
+}
+
+void psmouse_debugfs_init(struct psmouse *psmouse)
+{
+	struct psmouse_debug *debug;
+	struct serio *serio = psmouse->ps2dev.serio;
+
+	debug = kzalloc(sizeof(*debug), GFP_KERNEL);
+	if (!debug)
+		return;
+
+	mutex_init(&debug->capture_mutex);
+	spin_lock_init(&debug->timing_lock);
+
+	debug->dir = debugfs_create_dir(dev_name(&serio->dev),
+					psmouse_debugfs_root);
+	debugfs_create_file("capture", 0400, debug->dir, psmouse,
+			    &psmouse_debugfs_capture_fops);
+	debugfs_create_file("capture_size", 0600, debug->dir, psmouse,
+			    &psmouse_debugfs_capture_size_fops);
+	debugfs_create_file("history", 0400, debug->dir, psmouse,
+			    &psmouse_debugfs_history_fops);
+	debugfs_create_file("timing", 0400, debug->dir, psmouse,
+			    &psmouse_debugfs_timing_fops);
+
+	psmouse->debug = debug;
+
+	psmouse_debugfs_init_inject(psmouse);
+}
+
+void psmouse_debugfs_cleanup(struct psmouse *psmouse)
+{
+	struct psmouse_debug *debug = psmouse->debug;
+
+	if (!debug)
+		return;
+
+	debugfs_remove_recursive(debug->dir);
+
+	if (debug->capture_size)
+		psmouse_debugfs_stop_capture(psmouse);
+
+	psmouse->debug = NULL;
+	kfree(debug);
+}
+
+void psmouse_debugfs_module_init(void)
+{
+	psmouse_debugfs_root = debugfs_create_dir("psmouse", NULL);
+}
+
+void psmouse_debugfs_module_exit(void)
+{
+	debugfs_remove_recursive(psmouse_debugfs_root);
+}
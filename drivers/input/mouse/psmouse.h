@@ -20,6 +20,9 @@
 #define PSMOUSE_CMD_RESET_DIS	0x00f6
 #define PSMOUSE_CMD_RESET_BAT	0x02ff
 
+/* Not a device command: how psmouse_sliced_command() shows up in timing */
+#define PSMOUSE_CMD_SLICED	0x10000
+
 #define PSMOUSE_RET_BAT		0xaa
 #define PSMOUSE_RET_ID		0x00
 #define PSMOUSE_RET_ACK		0xfa
@@ -74,6 +77,30 @@ enum psmouse_type {
 };
 
 struct psmouse;
+struct psmouse_debug;
+
+/*
+ * Format of the byte capture read from debugfs: one record per byte
+ * received from the port, in arrival order.  time_ns is CLOCK_MONOTONIC,
+ * flags are the SERIO_* flags the byte arrived with, state and pktcnt
+ * are the psmouse state and packet position before the byte was handled.
+ */
+struct psmouse_byte_record {
+	__le64 time_ns;
+	u8 data;
+	u8 flags;
+	u8 state;
+	u8 pktcnt;
+} __packed;
+
+/*
+ * Number of most recent bytes each port always keeps, so that the
+ * sequence leading up to a loss of sync can be reported.  Must be a
+ * power of 2.  Only the raw bytes are kept, not decoded packets: the
+ * history is filled before the protocol handler sees a byte, and the
+ * bytes that lost sync never formed a packet in the first place.
+ */
+#define PSMOUSE_HISTORY_SIZE	32
 
 struct psmouse_protocol {
 	enum psmouse_type type;
@@ -96,12 +123,16 @@ struct psmouse {
 	const char *name;
 	const struct psmouse_protocol *protocol;
 	unsigned char packet[8];
+	ktime_t packet_time;	/* arrival of the packet's first byte */
+	ktime_t last_packet;	/* packet_time of the last full packet */
+	struct list_head node;	/* in the list of connected ports */
 	unsigned char badbyte;
 	unsigned char pktcnt;
 	unsigned char pktsize;
 	unsigned char oob_data_type;
 	unsigned char extra_buttons;
 	bool acks_disable_command;
+	bool input_elsewhere;	/* protocol reports through another device */
 	unsigned int model;
 	unsigned long last;
 	unsigned long out_of_sync_cnt;
@@ -110,6 +141,10 @@ struct psmouse {
 	char devname[64];
 	char phys[32];
 
+	struct psmouse_byte_record history[PSMOUSE_HISTORY_SIZE];
+	unsigned int history_head;
+	struct psmouse_debug *debug;
+
 	unsigned int rate;
 	unsigned int resolution;
 	unsigned int resetafter;
@@ -133,8 +168,19 @@ struct psmouse {
 
 struct psmouse *psmouse_from_serio(struct serio *serio);
 
+static inline struct psmouse_byte_record *
+psmouse_history_entry(struct psmouse *psmouse, unsigned int index)
+{
+	return &psmouse->history[index & (PSMOUSE_HISTORY_SIZE - 1)];
+}
+
 void psmouse_queue_work(struct psmouse *psmouse, struct delayed_work *work,
 		unsigned long delay);
+bool psmouse_trylock(void);
+void psmouse_unlock(void);
+ktime_t psmouse_sibling_activity(struct psmouse *psmouse);
+int psmouse_command(struct psmouse *psmouse, u8 *param, unsigned int command);
+int psmouse_sliced_command(struct psmouse *psmouse, u8 command);
 int psmouse_reset(struct psmouse *psmouse);
 void psmouse_set_state(struct psmouse *psmouse, enum psmouse_state new_state);
 void psmouse_set_resolution(struct psmouse *psmouse, unsigned int resolution);
@@ -249,4 +295,62 @@ static inline void psmouse_smbus_cleanup(struct psmouse *psmouse)
 
 #endif /* CONFIG_MOUSE_PS2_SMBUS */
 
+#define PSMOUSE_CAPTURE_MAX	(1 << 18)
+
+#ifdef CONFIG_MOUSE_PS2_DEBUGFS
+
+void psmouse_debugfs_module_init(void);
+void psmouse_debugfs_module_exit(void);
+void psmouse_debugfs_init(struct psmouse *psmouse);
+void psmouse_debugfs_cleanup(struct psmouse *psmouse);
+void psmouse_debugfs_capture(struct psmouse *psmouse,
+			     const struct psmouse_byte_record *rec);
+void psmouse_debugfs_snapshot(struct psmouse *psmouse, const char *reason);
+void psmouse_debugfs_command(struct psmouse *psmouse, unsigned int command,
+			     ktime_t start, int error);
+void psmouse_debugfs_probe(struct psmouse *psmouse, const void *fn,
+			   ktime_t start, int result);
+
+#else /* !CONFIG_MOUSE_PS2_DEBUGFS */
+
+static inline void psmouse_debugfs_module_init(void)
+{
+}
+
+static inline void psmouse_debugfs_module_exit(void)
+{
+}
+
+static inline void psmouse_debugfs_init(struct psmouse *psmouse)
+{
+}
+
+static inline void psmouse_debugfs_cleanup(struct psmouse *psmouse)
+{
+}
+
+static inline void psmouse_debugfs_capture(struct psmouse *psmouse,
+				const struct psmouse_byte_record *rec)
+{
+}
+
+static inline void psmouse_debugfs_snapshot(struct psmouse *psmouse,
+					    const char *reason)
+{
+}
+
+static inline void psmouse_debugfs_command(struct psmouse *psmouse,
+					   unsigned int command,
+					   ktime_t start, int error)
+{
+}
+
+static inline void psmouse_debugfs_probe(struct psmouse *psmouse,
+					 const void *fn,
+					 ktime_t start, int result)
+{
+}
+
+#endif /* CONFIG_MOUSE_PS2_DEBUGFS */
+
 #endif /* _PSMOUSE_H */
@@ -0,0 +1,606 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Emulates a Fujitsu Scroll Wheel or Scroll Sensor behind a virtual serio
+ * port created through userio (CONFIG_USERIO, /dev/userio).  Commands are
+ * answered the way protocol.txt describes, and once the driver has turned
+ * data mode on the packets of a script are streamed at the report rate.
+ *
+ * The port shows up as an i8042 AUX port, so psmouse probes it like any
+ * other.  fujitsu_scroll_detect() still requires DMI to name Fujitsu as
+ * the system vendor; elsewhere load psmouse with fujitsu_force=1.
+ *
+ * -r sets the report rate the device starts with and returns to on a
+ * reset.  The driver sets the rate it wants anyway, so this mostly
+ * matters with -w: then the script is not streamed but written to a file,
+ * in the format of the psmouse debugfs capture, as a device in data mode
+ * at that rate would have sent it.  That is what replay takes.
+ *
+ * Script lines, '#' starts a comment:
+ *   touch <c> <a> [<n>]          n packets (default 1) of capacitance c at
+ *                                position a
+ *   swipe <c> <from> <to> <n>    n packets of capacitance c moving from one
+ *                                position to the other
+ *   release [<n>]                n packets with nothing touched
+ *   button down|up               set or clear the press bit of the packets
+ *                                that follow
+ *   sleep <ms>                   send nothing for a while
+ *   bytes <b> ...                send raw bytes, e.g. a short packet
+ */
+
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/serio.h>
+#include <linux/userio.h>
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+
+#define PS2_ACK			0xfa
+#define PS2_NAK			0xfe
+#define PS2_BAT_OK		0xaa
+
+#define FJS_PACKET_SIZE		6
+#define FJS_MODE_ENABLE		0x80
+#define FJS_MODE_PRESS_ONLY	0x20
+#define FJS_MODE_RATE		20
+#define FJS_PRESSED		0x10
+
+/* struct psmouse_byte_record, time_ns little endian */
+struct emu_record {
+	uint64_t time_ns;
+	uint8_t data;
+	uint8_t flags;
+	uint8_t state;
+	uint8_t pktcnt;
+} __attribute__((packed));
+
+#define EMU_STATE_ACTIVATED	4	/* PSMOUSE_ACTIVATED */
+
+/* How long the device holds its packets back after each command byte */
+#define EMU_QUIET_MS		20
+#define EMU_MAX_BYTES		16
+
+/* GETINFO answers after a sliced command, by its low 4 bits */
+static const uint8_t emu_wheel_info[16][3] = {
+	{ 0x04, 0x43, 0x07 }, { 0x03, 0x00, 0x00 }, { 0x00, 0x00, 0x05 },
+	{ 0x75, 0x82, 0x00 }, { 0x3b, 0x0f, 0x52 }, { 0x11, 0x36, 0xeb },
+	{ 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x48, 0x0b, 0x00 },
+	{ 0x00, 0x09, 0x00 }, { 0x09, 0x9b, 0x52 }, { 0x00, 0x00, 0x00 },
+	{ 0x02, 0x00, 0x00 }, { 0x00, 0x3e, 0x02 }, { 0x85, 0xf4, 0x00 },
+	{ 0x0b, 0xf4, 0xe3 },
+};
+
+static const uint8_t emu_sensor_info[16][3] = {
+	{ 0x00, 0x43, 0x07 }, { 0x02, 0x00, 0x00 }, { 0x00, 0x00, 0x04 },
+	{ 0x74, 0x92, 0x00 }, { 0x25, 0x06, 0x4f }, { 0x23, 0xbf, 0xb9 },
+	{ 0x00, 0x00, 0x00 }, { 0x00, 0x00, 0x00 }, { 0x7c, 0x02, 0x00 },
+	{ 0x00, 0x09, 0x04 }, { 0x07, 0xdd, 0x5b }, { 0x00, 0x00, 0x00 },
+	{ 0x02, 0x00, 0x00 }, { 0xe0, 0xff, 0x00 }, { 0x57, 0x86, 0xfd },
+	{ 0x02, 0xed, 0x00 },
+};
+
+enum emu_step_type {
+	EMU_TOUCH,
+	EMU_BUTTON,
+	EMU_SLEEP,
+	EMU_BYTES,
+};
+
+struct emu_step {
+	enum emu_step_type type;
+	unsigned int capacitance;
+	int from, to;
+	unsigned int count;		/* packets, or ms for EMU_SLEEP */
+	uint8_t bytes[EMU_MAX_BYTES];
+};
+
+struct emu {
+	int fd;
+	FILE *out;			/* capture written instead, with -w */
+	uint64_t clock;			/* of the capture, ms */
+	int verbose;
+	const uint8_t (*info)[3];
+	uint8_t reset_rate;		/* report rate after a reset, -r */
+
+	/* Device state, as set by the host */
+	uint8_t pending;		/* command waiting for its parameter */
+	uint8_t sliced;			/* last four SETRES arguments */
+	unsigned int slices;
+	uint8_t mode;
+	uint8_t rate;
+	uint8_t resolution;
+	bool enabled;
+	bool button;
+
+	/* Script position */
+	struct emu_step *steps;
+	unsigned int num_steps;
+	unsigned int step, packet;
+	bool loop;
+
+	uint64_t next_due;
+	uint64_t quiet_until;
+};
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void emu_send(struct emu *e, uint8_t byte)
+{
+	struct userio_cmd cmd = {
+		.type = USERIO_CMD_SEND_INTERRUPT,
+		.data = byte,
+	};
+	struct emu_record rec = {
+		.time_ns = htole64(e->clock * 1000000),
+		.data = byte,
+		.state = EMU_STATE_ACTIVATED,
+	};
+
+	if (e->out) {
+		if (fwrite(&rec, sizeof(rec), 1, e->out) != 1) {
+			perror("write");
+			exit(1);
+		}
+		return;
+	}
+
+	if (write(e->fd, &cmd, sizeof(cmd)) != sizeof(cmd)) {
+		perror("userio");
+		exit(1);
+	}
+}
+
+static void emu_send_info(struct emu *e)
+{
+	int i;
+
+	if (e->slices >= 4) {
+		for (i = 0; i < 3; i++)
+			emu_send(e, e->info[e->sliced & 0x0f][i]);
+		return;
+	}
+
+	/* Plain PS/2 status: stream mode, reporting state, resolution, rate */
+	emu_send(e, e->enabled ? 0x20 : 0x00);
+	emu_send(e, e->resolution);
+	emu_send(e, e->rate);
+}
+
+static void emu_param(struct emu *e, uint8_t cmd, uint8_t param)
+{
+	switch (cmd) {
+	case 0xe8:	/* SETRES, also what sliced commands are made of */
+		e->sliced = e->sliced << 2 | (param & 3);
+		e->slices++;
+		e->resolution = param;
+		return;
+
+	case 0xf3:	/* SETRATE, which also terminates a mode byte */
+		if (e->slices >= 4 && param == FJS_MODE_RATE) {
+			e->mode = e->sliced;
+			if (e->verbose)
+				fprintf(stderr, "mode 0x%02x\n", e->mode);
+		} else {
+			e->rate = param;
+		}
+		break;
+	}
+
+	e->slices = 0;
+}
+
+static void emu_command(struct emu *e, uint8_t cmd)
+{
+	if (e->pending) {
+		emu_send(e, PS2_ACK);
+		emu_param(e, e->pending, cmd);
+		e->pending = 0;
+		return;
+	}
+
+	switch (cmd) {
+	case 0xe8:	/* SETRES */
+	case 0xf3:	/* SETRATE */
+		emu_send(e, PS2_ACK);
+		e->pending = cmd;
+		return;
+
+	case 0xe9:	/* GETINFO */
+		emu_send(e, PS2_ACK);
+		emu_send_info(e);
+		break;
+
+	case 0xf2:	/* GETID */
+		emu_send(e, PS2_ACK);
+		emu_send(e, 0x00);
+		break;
+
+	case 0xf4:	/* ENABLE */
+		emu_send(e, PS2_ACK);
+		e->enabled = true;
+		break;
+
+	case 0xf5:	/* DISABLE */
+		emu_send(e, PS2_ACK);
+		e->enabled = false;
+		break;
+
+	case 0xf6:	/* RESET_DIS */
+		emu_send(e, PS2_ACK);
+		e->enabled = false;
+		e->rate = e->reset_rate;
+		e->resolution = 2;
+		break;
+
+	case 0xff:	/* RESET_BAT */
+		emu_send(e, PS2_ACK);
+		e->enabled = false;
+		e->mode = 0;
+		e->rate = e->reset_rate;
+		e->resolution = 2;
+		emu_send(e, PS2_BAT_OK);
+		emu_send(e, 0x00);
+		break;
+
+	case 0xeb:	/* POLL: nothing to report */
+		emu_send(e, PS2_ACK);
+		emu_send(e, 0x00);
+		emu_send(e, 0x00);
+		emu_send(e, 0x00);
+		break;
+
+	case 0xee:	/* ECHO */
+		emu_send(e, cmd);
+		break;
+
+	case 0xe6:	/* SETSCALE11, starts a sliced command */
+	case 0xe7:	/* SETSCALE21 */
+	case 0xea:	/* SETSTREAM */
+	case 0xec:	/* RESET_WRAP */
+	case 0xf0:	/* SETPOLL */
+		emu_send(e, PS2_ACK);
+		break;
+
+	default:
+		emu_send(e, PS2_NAK);
+		break;
+	}
+
+	/* Any command but SETRES ends a sliced command */
+	e->slices = 0;
+}
+
+static bool emu_streaming(struct emu *e)
+{
+	return e->enabled && (e->mode & FJS_MODE_ENABLE);
+}
+
+static void emu_send_packet(struct emu *e, unsigned int c, int a)
+{
+	uint8_t pressed = e->button ? FJS_PRESSED : 0;
+	uint8_t pkt[FJS_PACKET_SIZE];
+	int i;
+
+	/* In press-only mode only presses are reported, and nothing else */
+	if (e->mode & FJS_MODE_PRESS_ONLY) {
+		if (!pressed)
+			return;
+		c = a = 0;
+	}
+
+	a &= 0xfff;
+	pkt[0] = 0x80 | (c & 0x3f);
+	pkt[1] = a >> 8;
+	pkt[2] = a & 0xff;
+	pkt[3] = 0xc0;
+	pkt[4] = pressed;
+	pkt[5] = 0;
+
+	for (i = 0; i < FJS_PACKET_SIZE; i++)
+		emu_send(e, pkt[i]);
+}
+
+/* Runs the current script step one packet further; false once done */
+static bool emu_step(struct emu *e, uint64_t now)
+{
+	struct emu_step *s;
+	unsigned int i;
+	int a;
+
+	if (e->step >= e->num_steps) {
+		if (!e->loop || !e->num_steps)
+			return false;
+		e->step = 0;
+	}
+
+	s = &e->steps[e->step];
+	e->next_due = now + 1000 / (e->rate ? e->rate : 100);
+
+	switch (s->type) {
+	case EMU_TOUCH:
+		a = s->count > 1 ?
+			s->from + (s->to - s->from) * (int)e->packet /
+				  (int)(s->count - 1) :
+			s->from;
+		emu_send_packet(e, s->capacitance, a);
+		if (++e->packet < s->count)
+			return true;
+		break;
+
+	case EMU_BUTTON:
+		e->button = s->count;
+		e->next_due = now;
+		break;
+
+	case EMU_SLEEP:
+		e->next_due = now + s->count;
+		break;
+
+	case EMU_BYTES:
+		for (i = 0; i < s->count; i++)
+			emu_send(e, s->bytes[i]);
+		break;
+	}
+
+	e->packet = 0;
+	e->step++;
+	return true;
+}
+
+static void emu_parse_error(const char *file, unsigned int line,
+			    const char *text)
+{
+	fprintf(stderr, "%s:%u: cannot parse '%s'\n", file, line, text);
+	exit(2);
+}
+
+static void emu_load_script(struct emu *e, const char *file)
+{
+	FILE *f = strcmp(file, "-") ? fopen(file, "r") : stdin;
+	char buf[256], word[16], *p;
+	struct emu_step s;
+	unsigned int line = 0, b;
+	int n, off;
+
+	if (!f) {
+		perror(file);
+		exit(1);
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		line++;
+		p = strchr(buf, '#');
+		if (p)
+			*p = '\0';
+		p = buf + strcspn(buf, "\n");
+		*p = '\0';
+
+		if (sscanf(buf, "%15s%n", word, &off) != 1)
+			continue;
+
+		memset(&s, 0, sizeof(s));
+		s.count = 1;
+		p = buf + off;
+
+		if (!strcmp(word, "touch")) {
+			n = sscanf(p, "%u %d %u", &s.capacitance, &s.from,
+				   &s.count);
+			if (n < 2)
+				emu_parse_error(file, line, buf);
+			s.to = s.from;
+		} else if (!strcmp(word, "swipe")) {
+			if (sscanf(p, "%u %d %d %u", &s.capacitance, &s.from,
+				   &s.to, &s.count) != 4)
+				emu_parse_error(file, line, buf);
+		} else if (!strcmp(word, "release")) {
+			sscanf(p, "%u", &s.count);
+		} else if (!strcmp(word, "button")) {
+			s.type = EMU_BUTTON;
+			if (sscanf(p, "%15s", word) != 1 ||
+			    (strcmp(word, "down") && strcmp(word, "up")))
+				emu_parse_error(file, line, buf);
+			s.count = !strcmp(word, "down");
+		} else if (!strcmp(word, "sleep")) {
+			s.type = EMU_SLEEP;
+			if (sscanf(p, "%u", &s.count) != 1)
+				emu_parse_error(file, line, buf);
+		} else if (!strcmp(word, "bytes")) {
+			s.type = EMU_BYTES;
+			for (s.count = 0; sscanf(p, "%x%n", &b, &off) == 1;
+			     p += off) {
+				if (s.count == EMU_MAX_BYTES || b > 0xff)
+					emu_parse_error(file, line, buf);
+				s.bytes[s.count++] = b;
+			}
+		} else {
+			emu_parse_error(file, line, buf);
+		}
+
+		if (s.type == EMU_TOUCH && !s.count)
+			emu_parse_error(file, line, buf);
+
+		e->steps = realloc(e->steps, (e->num_steps + 1) * sizeof(s));
+		if (!e->steps) {
+			perror("realloc");
+			exit(1);
+		}
+		e->steps[e->num_steps++] = s;
+	}
+
+	if (f != stdin)
+		fclose(f);
+}
+
+static void emu_register(struct emu *e)
+{
+	struct userio_cmd cmd[] = {
+		{ .type = USERIO_CMD_SET_PORT_TYPE, .data = SERIO_8042 },
+		{ .type = USERIO_CMD_REGISTER },
+	};
+	unsigned int i;
+
+	e->fd = open("/dev/userio", O_RDWR);
+	if (e->fd < 0) {
+		perror("/dev/userio");
+		exit(1);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cmd); i++) {
+		if (write(e->fd, &cmd[i], sizeof(cmd[i])) != sizeof(cmd[i])) {
+			perror("userio");
+			exit(1);
+		}
+	}
+}
+
+/* Plays the script on a clock of its own, starting at 1 s */
+static void emu_write(struct emu *e, const char *file)
+{
+	e->out = fopen(file, "wb");
+	if (!e->out) {
+		perror(file);
+		exit(1);
+	}
+
+	e->enabled = true;
+	e->mode = FJS_MODE_ENABLE;
+	e->clock = 1000;
+	while (emu_step(e, e->clock))
+		e->clock = e->next_due;
+
+	if (fclose(e->out)) {
+		perror(file);
+		exit(1);
+	}
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d wheel|sensor] [-l] [-r rate] [-v] [-w capture] "
+		"script\n"
+		"  -d  device to emulate (default wheel)\n"
+		"  -l  repeat the script for as long as the port is open\n"
+		"  -r  report rate after a reset, 10 to 200 (default 100)\n"
+		"  -v  log the commands received and the mode set\n"
+		"  -w  write the script to a capture file for replay\n",
+		prog);
+	exit(2);
+}
+
+int main(int argc, char **argv)
+{
+	struct emu e = {
+		.info = emu_wheel_info,
+		.rate = 100,
+		.reset_rate = 100,
+		.resolution = 2,
+	};
+	const char *capture = NULL;
+	unsigned long rate;
+	char *end;
+	struct pollfd pfd;
+	uint8_t buf[64];
+	uint64_t now;
+	bool more = true;
+	ssize_t len;
+	int c, i, timeout;
+
+	while ((c = getopt(argc, argv, "d:lr:vw:")) != -1) {
+		switch (c) {
+		case 'd':
+			if (!strcmp(optarg, "wheel"))
+				e.info = emu_wheel_info;
+			else if (!strcmp(optarg, "sensor"))
+				e.info = emu_sensor_info;
+			else
+				usage(argv[0]);
+			break;
+		case 'l':
+			e.loop = true;
+			break;
+		case 'r':
+			rate = strtoul(optarg, &end, 0);
+			if (*end || rate < 10 || rate > 200)
+				usage(argv[0]);
+			e.rate = e.reset_rate = rate;
+			break;
+		case 'v':
+			e.verbose++;
+			break;
+		case 'w':
+			capture = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind != argc - 1 || (capture && e.loop))
+		usage(argv[0]);
+
+	emu_load_script(&e, argv[optind]);
+
+	if (capture) {
+		emu_write(&e, capture);
+		return 0;
+	}
+
+	emu_register(&e);
+
+	pfd.fd = e.fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		now = now_ms();
+		timeout = -1;
+		if (more && emu_streaming(&e)) {
+			timeout = e.next_due > now ? e.next_due - now : 0;
+			if (e.quiet_until > now + timeout)
+				timeout = e.quiet_until - now;
+		}
+
+		if (poll(&pfd, 1, timeout) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return 1;
+		}
+
+		if (pfd.revents & POLLIN) {
+			len = read(e.fd, buf, sizeof(buf));
+			if (len <= 0) {
+				perror("userio");
+				return 1;
+			}
+
+			for (i = 0; i < len; i++) {
+				if (e.verbose)
+					fprintf(stderr, "host 0x%02x\n", buf[i]);
+				emu_command(&e, buf[i]);
+			}
+
+			e.quiet_until = now_ms() + EMU_QUIET_MS;
+			continue;
+		}
+
+		now = now_ms();
+		if (more && emu_streaming(&e) && now >= e.quiet_until &&
+		    now >= e.next_due)
+			more = emu_step(&e, now);
+	}
+}
@@ -0,0 +1,623 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Userspace implementation of the kernel stand-ins in kernel.h.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include "kernel.h"
+
+int fjs_verbose;
+bool fjs_quiet;
+unsigned long jiffies;
+static ktime_t fjs_now;
+
+/*****************************************************************************
+ *	Time, timers and work items
+ ****************************************************************************/
+
+ktime_t ktime_get(void)
+{
+	return fjs_now;
+}
+
+static void fjs_set_time(ktime_t time)
+{
+	if (time > fjs_now)
+		fjs_now = time;
+	jiffies = fjs_now / (NSEC_PER_SEC / HZ);
+}
+
+static struct fjs_event *fjs_events;
+
+void fjs_queue(struct fjs_event *ev, ktime_t due)
+{
+	fjs_dequeue(ev);
+	ev->due = due;
+	ev->queued = true;
+	ev->next = fjs_events;
+	fjs_events = ev;
+}
+
+bool fjs_dequeue(struct fjs_event *ev)
+{
+	struct fjs_event **p;
+
+	if (!ev->queued)
+		return false;
+
+	for (p = &fjs_events; *p != ev; p = &(*p)->next)
+		;
+	*p = ev->next;
+	ev->queued = false;
+	return true;
+}
+
+/*
+ * Runs everything due up to the given time, earliest first, with the
+ * clock set to when each of them is due; then moves the clock there.
+ */
+void fjs_run_until(ktime_t time)
+{
+	struct fjs_event *ev, *first;
+
+	for (;;) {
+		first = NULL;
+		for (ev = fjs_events; ev; ev = ev->next)
+			if (ev->due <= time && (!first || ev->due < first->due))
+				first = ev;
+		if (!first)
+			break;
+
+		fjs_dequeue(first);
+		fjs_set_time(first->due);
+		first->run(first);
+	}
+
+	fjs_set_time(time);
+}
+
+static void fjs_hrtimer_run(struct fjs_event *ev)
+{
+	struct hrtimer *timer = container_of(ev, struct hrtimer, ev);
+
+	if (timer->function(timer) == HRTIMER_RESTART)
+		fjs_queue(ev, ev->due);
+}
+
+void hrtimer_setup(struct hrtimer *timer,
+		   enum hrtimer_restart (*function)(struct hrtimer *),
+		   int clock_id, enum hrtimer_mode mode)
+{
+	memset(timer, 0, sizeof(*timer));
+	timer->function = function;
+	timer->ev.run = fjs_hrtimer_run;
+}
+
+void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+		   enum hrtimer_mode mode)
+{
+	fjs_queue(&timer->ev, mode == HRTIMER_MODE_REL ? fjs_now + tim : tim);
+}
+
+int hrtimer_cancel(struct hrtimer *timer)
+{
+	return fjs_dequeue(&timer->ev);
+}
+
+int hrtimer_try_to_cancel(struct hrtimer *timer)
+{
+	return fjs_dequeue(&timer->ev);
+}
+
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval)
+{
+	u64 overruns;
+
+	if (fjs_now < timer->ev.due)
+		return 0;
+
+	overruns = (fjs_now - timer->ev.due) / interval + 1;
+	timer->ev.due += overruns * interval;
+	return overruns;
+}
+
+struct workqueue_struct *system_highpri_wq;
+
+static void fjs_work_run(struct fjs_event *ev)
+{
+	struct work_struct *work = container_of(ev, struct work_struct, ev);
+
+	work->func(work);
+}
+
+void fjs_init_work(struct work_struct *work, work_func_t func)
+{
+	memset(work, 0, sizeof(*work));
+	work->func = func;
+	work->ev.run = fjs_work_run;
+}
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work)
+{
+	return queue_delayed_work(wq, container_of(work, struct delayed_work,
+						   work), 0);
+}
+
+bool queue_delayed_work(struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay)
+{
+	struct fjs_event *ev = &dwork->work.ev;
+
+	if (ev->queued || dwork->work.disable)
+		return false;
+
+	fjs_queue(ev, fjs_now + (ktime_t)delay * (NSEC_PER_SEC / HZ));
+	return true;
+}
+
+bool cancel_work_sync(struct work_struct *work)
+{
+	return fjs_dequeue(&work->ev);
+}
+
+/* Work items never run concurrently here, so only the count is kept */
+bool disable_work_sync(struct work_struct *work)
+{
+	work->disable++;
+	return fjs_dequeue(&work->ev);
+}
+
+bool enable_work(struct work_struct *work)
+{
+	return !--work->disable;
+}
+
+bool cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	return fjs_dequeue(&dwork->work.ev);
+}
+
+/*****************************************************************************
+ *	Arithmetic, memory, strings, parameters
+ ****************************************************************************/
+
+struct reciprocal_value reciprocal_value(u32 d)
+{
+	struct reciprocal_value R;
+	int l = d > 1 ? 32 - __builtin_clz(d - 1) : 0;
+	u64 m = ((1ULL << 32) * ((1ULL << l) - d)) / d + 1;
+
+	R.m = (u32)m;
+	R.sh1 = min(l, 1);
+	R.sh2 = max(l - 1, 0);
+	return R;
+}
+
+bool fjs_warn_on(bool cond, const char *what, const char *file, int line)
+{
+	if (cond)
+		fprintf(stderr, "WARNING: %s at %s:%d\n", what, file, line);
+	return cond;
+}
+
+void *kzalloc(size_t size, gfp_t flags)
+{
+	return calloc(1, size);
+}
+
+void *kmemdup(const void *src, size_t len, gfp_t flags)
+{
+	void *p = malloc(len);
+
+	if (p)
+		memcpy(p, src, len);
+	return p;
+}
+
+void kfree(const void *p)
+{
+	free((void *)p);
+}
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	unsigned long val;
+	char *end;
+
+	if (*s < '0' || *s > '9')
+		return -EINVAL;
+
+	errno = 0;
+	val = strtoul(s, &end, base);
+	if (*end == '\n')
+		end++;
+	if (*end)
+		return -EINVAL;
+	if (errno || val > UINT32_MAX)
+		return -ERANGE;
+
+	*res = val;
+	return 0;
+}
+
+bool sysfs_streq(const char *s1, const char *s2)
+{
+	while (*s1 && *s1 == *s2) {
+		s1++;
+		s2++;
+	}
+
+	if (*s1 == *s2)
+		return true;
+	if (!*s1 && *s2 == '\n' && !s2[1])
+		return true;
+	return *s1 == '\n' && !s1[1] && !*s2;
+}
+
+int __sysfs_match_string(const char * const *array, size_t n,
+			 const char *str)
+{
+	size_t i;
+
+	for (i = 0; i < n && array[i]; i++)
+		if (sysfs_streq(array[i], str))
+			return i;
+
+	return -EINVAL;
+}
+
+static struct fjs_param *fjs_params;
+
+void fjs_add_param(struct fjs_param *param)
+{
+	param->next = fjs_params;
+	fjs_params = param;
+}
+
+/* Arrays take comma separated values, as on the kernel command line */
+static int fjs_set_param_array(struct fjs_param *param, const char *val)
+{
+	char *copy = strdup(val), *elem, *rest = copy;
+	unsigned int n = 0;
+	int error = 0;
+
+	while (!error && (elem = strsep(&rest, ","))) {
+		if (n >= param->max)
+			error = -EINVAL;
+		else
+			error = param->set((char *)param->value +
+					   n++ * param->size, elem);
+	}
+
+	free(copy);
+	if (!error)
+		*param->num = n;
+
+	return error;
+}
+
+int fjs_set_param(const char *name, const char *val)
+{
+	struct fjs_param *param;
+
+	for (param = fjs_params; param; param = param->next) {
+		if (strcmp(param->name, name))
+			continue;
+		if (param->num)
+			return fjs_set_param_array(param, val);
+		return param->set(param->value, val);
+	}
+
+	return -ENOENT;
+}
+
+int fjs_param_set_short(void *value, const char *val)
+{
+	char *end;
+	long v = strtol(val, &end, 0);
+
+	if (*end || v < INT16_MIN || v > INT16_MAX)
+		return -EINVAL;
+
+	*(short *)value = v;
+	return 0;
+}
+
+int fjs_param_set_ushort(void *value, const char *val)
+{
+	char *end;
+	long v = strtol(val, &end, 0);
+
+	if (!*val || *end || v < 0 || v > UINT16_MAX)
+		return -EINVAL;
+
+	*(unsigned short *)value = v;
+	return 0;
+}
+
+int fjs_param_set_bool(void *value, const char *val)
+{
+	if (!strcmp(val, "1") || !strcmp(val, "y") || !strcmp(val, "Y"))
+		*(bool *)value = true;
+	else if (!strcmp(val, "0") || !strcmp(val, "n") || !strcmp(val, "N"))
+		*(bool *)value = false;
+	else
+		return -EINVAL;
+
+	return 0;
+}
+
+/*****************************************************************************
+ *	Devices, sysfs, debugfs
+ ****************************************************************************/
+
+const char *dev_name(const struct device *dev)
+{
+	return dev->kobj.name;
+}
+
+int device_add_group(struct device *dev, const struct attribute_group *grp)
+{
+	dev->group = grp;
+	return 0;
+}
+
+void device_remove_group(struct device *dev,
+			 const struct attribute_group *grp)
+{
+	dev->group = NULL;
+}
+
+/* Writes a sysfs attribute of the device, honouring is_visible */
+int fjs_store_attr(struct device *dev, const char *name, const char *val)
+{
+	const struct attribute_group *grp = dev->group;
+	struct device_attribute *dattr;
+	struct attribute *attr;
+	char buf[256];
+	ssize_t ret;
+	int i;
+
+	for (i = 0; grp && (attr = grp->attrs[i]); i++) {
+		if (strcmp(attr->name, name))
+			continue;
+		if (grp->is_visible && !grp->is_visible(&dev->kobj, attr, i))
+			break;
+
+		dattr = container_of(attr, struct device_attribute, attr);
+		snprintf(buf, sizeof(buf), "%s\n", val);
+		ret = dattr->store(dev, dattr, buf, strlen(buf));
+		return ret < 0 ? ret : 0;
+	}
+
+	return -ENOENT;
+}
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data)
+{
+	struct seq_file *m = calloc(1, sizeof(*m));
+
+	if (!m)
+		return -ENOMEM;
+
+	m->private = data;
+	m->show = show;
+	file->private_data = m;
+	return 0;
+}
+
+int single_release(struct inode *inode, struct file *file)
+{
+	free(file->private_data);
+	return 0;
+}
+
+/* Only files are kept track of; dentries of directories are dummies */
+struct dentry {
+	const char *name;
+	void *data;
+	const struct file_operations *fops;
+	struct dentry *next;
+};
+
+static struct dentry fjs_debugfs_dir;
+static struct dentry *fjs_debugfs_files;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+	return &fjs_debugfs_dir;
+}
+
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops)
+{
+	struct dentry *d = calloc(1, sizeof(*d));
+
+	if (!d)
+		return NULL;
+
+	d->name = name;
+	d->data = data;
+	d->fops = fops;
+	d->next = fjs_debugfs_files;
+	fjs_debugfs_files = d;
+	return d;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+	struct dentry *d;
+
+	while ((d = fjs_debugfs_files)) {
+		fjs_debugfs_files = d->next;
+		free(d);
+	}
+}
+
+/* Prints a debugfs file created with DEFINE_SHOW_ATTRIBUTE() */
+void fjs_debugfs_show(const char *name)
+{
+	struct inode inode;
+	struct file file;
+	struct seq_file *m;
+	struct dentry *d;
+
+	for (d = fjs_debugfs_files; d; d = d->next) {
+		if (strcmp(d->name, name))
+			continue;
+
+		inode.i_private = d->data;
+		if (d->fops->open(&inode, &file))
+			return;
+
+		m = file.private_data;
+		m->show(m, NULL);
+		d->fops->release(&inode, &file);
+		return;
+	}
+}
+
+/*****************************************************************************
+ *	Input core
+ ****************************************************************************/
+
+static struct input_dev *fjs_inputs;
+
+struct input_dev *input_allocate_device(void)
+{
+	return calloc(1, sizeof(struct input_dev));
+}
+
+void input_free_device(struct input_dev *dev)
+{
+	free(dev);
+}
+
+int input_register_device(struct input_dev *dev)
+{
+	dev->registered = true;
+	dev->next = fjs_inputs;
+	fjs_inputs = dev;
+	return 0;
+}
+
+void input_unregister_device(struct input_dev *dev)
+{
+	struct input_dev **p;
+
+	for (p = &fjs_inputs; *p && *p != dev; p = &(*p)->next)
+		;
+	if (*p)
+		*p = dev->next;
+
+	if (dev->opened && dev->close)
+		dev->close(dev);
+	free(dev);
+}
+
+/* Opens every registered device, as a reader like evtest would */
+void fjs_open_inputs(void)
+{
+	struct input_dev *dev;
+
+	for (dev = fjs_inputs; dev; dev = dev->next) {
+		if (dev->opened)
+			continue;
+		if (dev->open && dev->open(dev))
+			continue;
+		dev->opened = true;
+	}
+}
+
+void input_set_capability(struct input_dev *dev, unsigned int type,
+			  unsigned int code)
+{
+	switch (type) {
+	case EV_KEY:
+		__set_bit(code, dev->keybit);
+		break;
+	case EV_REL:
+		__set_bit(code, dev->relbit);
+		break;
+	case EV_ABS:
+		__set_bit(code, dev->absbit);
+		break;
+	case EV_MSC:
+		__set_bit(code, dev->mscbit);
+		break;
+	}
+
+	__set_bit(type, dev->evbit);
+}
+
+void input_set_abs_params(struct input_dev *dev, unsigned int axis,
+			  int min, int max, int fuzz, int flat)
+{
+	dev->absinfo[axis].minimum = min;
+	dev->absinfo[axis].maximum = max;
+	input_set_capability(dev, EV_ABS, axis);
+}
+
+void input_set_timestamp(struct input_dev *dev, ktime_t timestamp)
+{
+	dev->timestamp = timestamp;
+}
+
+static bool fjs_capable(struct input_dev *dev, unsigned int type,
+			unsigned int code)
+{
+	switch (type) {
+	case EV_SYN:
+		return true;
+	case EV_KEY:
+		return code < KEY_CNT && test_bit(code, dev->keybit);
+	case EV_REL:
+		return code < REL_CNT && test_bit(code, dev->relbit);
+	case EV_ABS:
+		return code < ABS_CNT && test_bit(code, dev->absbit);
+	case EV_MSC:
+		return code < MSC_CNT && test_bit(code, dev->mscbit);
+	}
+
+	return false;
+}
+
+/*
+ * Events are held back until the frame is complete, then printed one
+ * per line: the frame's timestamp (the one set with input_set_timestamp()
+ * or the time of the EV_SYN), the device, then type, code and value.
+ * The input core drops events a device did not advertise; they are
+ * printed with a "!" so they show up in diffs.
+ */
+void input_event(struct input_dev *dev, unsigned int type,
+		 unsigned int code, int value)
+{
+	struct input_value *v;
+	ktime_t ts;
+	int i;
+
+	if (dev->num_vals < ARRAY_SIZE(dev->vals)) {
+		v = &dev->vals[dev->num_vals++];
+		v->type = type;
+		v->code = code;
+		v->value = value;
+	}
+
+	if (type != EV_SYN)
+		return;
+
+	ts = dev->timestamp ? dev->timestamp : fjs_now;
+	for (i = 0; i < dev->num_vals && !fjs_quiet; i++) {
+		v = &dev->vals[i];
+		printf("%lld.%06lld %s %s%u %u %d\n",
+		       ts / NSEC_PER_SEC, ts % NSEC_PER_SEC / NSEC_PER_USEC,
+		       dev->phys, fjs_capable(dev, v->type, v->code) ? "" : "!",
+		       v->type, v->code, v->value);
+	}
+
+	dev->num_vals = 0;
+	dev->timestamp = 0;
+}
@@ -0,0 +1,630 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+/*
+ * Userspace stand-ins for the parts of the kernel API fujitsu_scroll.c
+ * uses.  Every <linux/...> header the driver includes is generated by
+ * the Makefile as a one-liner pulling in this file.
+ *
+ * There is a single thread and a virtual clock: ktime_get() and jiffies
+ * only move when the replay driver advances them, and hrtimers and work
+ * items run from fjs_run_until() once the clock reaches their expiry.
+ * Locks and RCU therefore have nothing to do.
+ */
+#ifndef _FJS_KERNEL_H
+#define _FJS_KERNEL_H
+
+#include <endian.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <linux/input-event-codes.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef long long s64;
+typedef u64 __le64;
+typedef s64 ktime_t;
+typedef unsigned int gfp_t;
+typedef unsigned short umode_t;
+
+#define cpu_to_le64(x)		htole64(x)
+#define le64_to_cpu(x)		le64toh(x)
+
+#define __packed		__attribute__((packed))
+#define __rcu
+#define __stringify_1(x)	#x
+#define __stringify(x)		__stringify_1(x)
+
+#define likely(x)		__builtin_expect(!!(x), 1)
+#define unlikely(x)		__builtin_expect(!!(x), 0)
+#define READ_ONCE(x)		(x)
+#define WRITE_ONCE(x, val)	((x) = (val))
+#define BUILD_BUG_ON(cond)	_Static_assert(!(cond), #cond)
+#define WARN_ON_ONCE(cond)	fjs_warn_on(!!(cond), #cond, __FILE__, __LINE__)
+#define lockdep_assert_held(l)	((void)(l))
+
+#define ENOENT			2
+#define EIO			5
+#define ENOMEM			12
+#define EBUSY			16
+#define ENODEV			19
+#define EINVAL			22
+#define ERANGE			34
+#define ENODATA			61
+
+#define GFP_KERNEL		0
+#define S_IRUSR			0400
+#define S_IWUSR			0200
+#define S_IRUGO			0444
+
+#define HZ			250
+#define NSEC_PER_USEC		1000L
+#define NSEC_PER_MSEC		1000000L
+#define NSEC_PER_SEC		1000000000L
+#define USEC_PER_MSEC		1000L
+#define USEC_PER_SEC		1000000L
+
+/*****************************************************************************
+ *	Arithmetic and bit operations
+ ****************************************************************************/
+
+#define ARRAY_SIZE(a)		(sizeof(a) / sizeof((a)[0]))
+#define container_of(ptr, type, member)				\
+	((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define BITS_PER_LONG		(8 * sizeof(long))
+#define BITS_TO_LONGS(n)	(((n) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#define BIT(n)			(1UL << (n))
+
+#define min(a, b)		((a) < (b) ? (a) : (b))
+#define max(a, b)		((a) > (b) ? (a) : (b))
+#define min_t(t, a, b)		min((t)(a), (t)(b))
+#define max_t(t, a, b)		max((t)(a), (t)(b))
+#define clamp(v, lo, hi)	min(max(v, lo), hi)
+#define clamp_t(t, v, lo, hi)	min_t(t, max_t(t, v, lo), hi)
+#define abs(x)	({ __typeof__(x) __x = (x); __x < 0 ? -__x : __x; })
+#define DIV_ROUND_UP(n, d)	(((n) + (d) - 1) / (d))
+/* Halves away from zero for either sign, d must be positive */
+#define DIV_ROUND_CLOSEST(n, d)	({ __typeof__(n) __n = (n);		\
+				   __n < 0 ? (__n - (d) / 2) / (d) :	\
+					     (__n + (d) / 2) / (d); })
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline s32 sign_extend32(u32 value, int index)
+{
+	u8 shift = 31 - index;
+
+	return (s32)(value << shift) >> shift;
+}
+
+static inline void __set_bit(unsigned int nr, unsigned long *addr)
+{
+	addr[nr / BITS_PER_LONG] |= 1UL << (nr % BITS_PER_LONG);
+}
+
+static inline bool test_bit(unsigned int nr, const unsigned long *addr)
+{
+	return addr[nr / BITS_PER_LONG] & (1UL << (nr % BITS_PER_LONG));
+}
+
+#define for_each_set_bit(bit, addr, size)				\
+	for ((bit) = 0; (bit) < (size); (bit)++)			\
+		if (test_bit(bit, addr))
+
+struct reciprocal_value {
+	u32 m;
+	u8 sh1, sh2;
+};
+
+struct reciprocal_value reciprocal_value(u32 d);
+
+static inline u32 reciprocal_divide(u32 a, struct reciprocal_value R)
+{
+	u32 t = (u32)(((u64)a * R.m) >> 32);
+
+	return (t + ((a - t) >> R.sh1)) >> R.sh2;
+}
+
+bool fjs_warn_on(bool cond, const char *what, const char *file, int line);
+
+/*****************************************************************************
+ *	Time
+ ****************************************************************************/
+
+extern unsigned long jiffies;
+
+#define time_after(a, b)	((long)((b) - (a)) < 0)
+#define time_before(a, b)	time_after(b, a)
+#define time_after_eq(a, b)	((long)((a) - (b)) >= 0)
+
+static inline unsigned long msecs_to_jiffies(unsigned int m)
+{
+	return DIV_ROUND_UP((unsigned long)m * HZ, 1000);
+}
+
+ktime_t ktime_get(void);
+
+static inline ktime_t ns_to_ktime(u64 ns)
+{
+	return ns;
+}
+
+static inline ktime_t ms_to_ktime(u64 ms)
+{
+	return ms * NSEC_PER_MSEC;
+}
+
+static inline s64 ktime_to_us(ktime_t kt)
+{
+	return kt / NSEC_PER_USEC;
+}
+
+static inline ktime_t ktime_add_ms(ktime_t kt, u64 ms)
+{
+	return kt + ms * NSEC_PER_MSEC;
+}
+
+static inline bool ktime_before(ktime_t a, ktime_t b)
+{
+	return a < b;
+}
+
+static inline s64 ktime_us_delta(ktime_t later, ktime_t earlier)
+{
+	return (later - earlier) / NSEC_PER_USEC;
+}
+
+static inline s64 ktime_ms_delta(ktime_t later, ktime_t earlier)
+{
+	return (later - earlier) / NSEC_PER_MSEC;
+}
+
+/*****************************************************************************
+ *	Timers and work items
+ ****************************************************************************/
+
+/* Something due on the virtual clock; queued ones sit on a single list */
+struct fjs_event {
+	ktime_t due;
+	bool queued;
+	void (*run)(struct fjs_event *ev);
+	struct fjs_event *next;
+};
+
+void fjs_queue(struct fjs_event *ev, ktime_t due);
+bool fjs_dequeue(struct fjs_event *ev);
+void fjs_run_until(ktime_t time);
+
+enum hrtimer_restart {
+	HRTIMER_NORESTART,
+	HRTIMER_RESTART,
+};
+
+enum hrtimer_mode {
+	HRTIMER_MODE_ABS,
+	HRTIMER_MODE_REL,
+};
+
+#define CLOCK_MONOTONIC		1
+
+struct hrtimer {
+	struct fjs_event ev;
+	enum hrtimer_restart (*function)(struct hrtimer *timer);
+};
+
+void hrtimer_setup(struct hrtimer *timer,
+		   enum hrtimer_restart (*function)(struct hrtimer *),
+		   int clock_id, enum hrtimer_mode mode);
+void hrtimer_start(struct hrtimer *timer, ktime_t tim,
+		   enum hrtimer_mode mode);
+int hrtimer_cancel(struct hrtimer *timer);
+int hrtimer_try_to_cancel(struct hrtimer *timer);
+u64 hrtimer_forward_now(struct hrtimer *timer, ktime_t interval);
+
+static inline void hrtimer_set_expires(struct hrtimer *timer, ktime_t time)
+{
+	timer->ev.due = time;
+}
+
+struct work_struct;
+typedef void (*work_func_t)(struct work_struct *work);
+
+struct work_struct {
+	struct fjs_event ev;
+	work_func_t func;
+	unsigned int disable;
+};
+
+struct delayed_work {
+	struct work_struct work;
+};
+
+struct workqueue_struct;
+extern struct workqueue_struct *system_highpri_wq;
+
+void fjs_init_work(struct work_struct *work, work_func_t func);
+
+#define INIT_WORK(w, f)		fjs_init_work(w, f)
+#define INIT_DELAYED_WORK(w, f)	fjs_init_work(&(w)->work, f)
+
+bool queue_work(struct workqueue_struct *wq, struct work_struct *work);
+bool queue_delayed_work(struct workqueue_struct *wq,
+			struct delayed_work *dwork, unsigned long delay);
+bool cancel_work_sync(struct work_struct *work);
+bool disable_work_sync(struct work_struct *work);
+bool enable_work(struct work_struct *work);
+bool cancel_delayed_work_sync(struct delayed_work *dwork);
+
+/*****************************************************************************
+ *	Locking, RCU, memory
+ ****************************************************************************/
+
+struct mutex {
+	int locked;
+};
+
+typedef struct {
+	int locked;
+} spinlock_t;
+
+#define DEFINE_MUTEX(m)		struct mutex m
+#define mutex_init(m)		((m)->locked = 0)
+#define mutex_lock(m)		((m)->locked++)
+#define mutex_unlock(m)		((m)->locked--)
+#define spin_lock_init(l)	((l)->locked = 0)
+#define spin_lock(l)		((l)->locked++)
+#define spin_unlock(l)		((l)->locked--)
+#define spin_lock_irqsave(l, flags)	((flags) = 0, spin_lock(l))
+#define spin_unlock_irqrestore(l, flags) ((void)(flags), spin_unlock(l))
+
+struct rcu_head {
+	void *unused;
+};
+
+#define rcu_read_lock()			do { } while (0)
+#define rcu_read_unlock()		do { } while (0)
+#define rcu_dereference(p)		(p)
+#define rcu_dereference_protected(p, c)	(p)
+#define rcu_assign_pointer(p, v)	((p) = (v))
+#define RCU_INIT_POINTER(p, v)		((p) = (v))
+#define kfree_rcu(p, field)		kfree(p)
+
+void *kzalloc(size_t size, gfp_t flags);
+void *kmemdup(const void *src, size_t len, gfp_t flags);
+void kfree(const void *p);
+
+/* A kfifo of fixed size, which must be a power of 2 */
+#define DECLARE_KFIFO(fifo, type, size)					\
+	struct {							\
+		unsigned int in, out;					\
+		type buf[size];						\
+	} fifo
+#define INIT_KFIFO(fifo)	((fifo).in = (fifo).out = 0)
+#define kfifo_reset(fifo)	((fifo)->in = (fifo)->out = 0)
+#define kfifo_is_empty(fifo)	((fifo)->in == (fifo)->out)
+#define kfifo_put(fifo, val)	({					\
+	__typeof__(fifo) __f = (fifo);					\
+	bool __ok = __f->in - __f->out < ARRAY_SIZE(__f->buf);		\
+	if (__ok)							\
+		__f->buf[__f->in++ % ARRAY_SIZE(__f->buf)] = (val);	\
+	__ok;								\
+})
+#define kfifo_get(fifo, val)	({					\
+	__typeof__(fifo) __f = (fifo);					\
+	bool __ok = __f->in != __f->out;				\
+	if (__ok)							\
+		*(val) = __f->buf[__f->out++ % ARRAY_SIZE(__f->buf)];	\
+	__ok;								\
+})
+
+/*****************************************************************************
+ *	Modules, strings, logging
+ ****************************************************************************/
+
+/* num is set for arrays, of max elements of size bytes each */
+struct fjs_param {
+	const char *name;
+	void *value;
+	int (*set)(void *value, const char *val);
+	unsigned int *num;
+	unsigned int max;
+	size_t size;
+	struct fjs_param *next;
+};
+
+void fjs_add_param(struct fjs_param *param);
+int fjs_set_param(const char *name, const char *val);
+int fjs_param_set_short(void *value, const char *val);
+int fjs_param_set_ushort(void *value, const char *val);
+int fjs_param_set_bool(void *value, const char *val);
+
+/* Module parameters can be set from the replay command line */
+#define module_param(_name, _type, _perm)				\
+	static struct fjs_param __fjs_param_##_name = {			\
+		.name	= #_name,					\
+		.value	= &_name,					\
+		.set	= fjs_param_set_##_type,			\
+	};								\
+	static void __attribute__((constructor)) __fjs_add_##_name(void) \
+	{								\
+		fjs_add_param(&__fjs_param_##_name);			\
+	}
+#define module_param_array(_name, _type, _num, _perm)			\
+	static struct fjs_param __fjs_param_##_name = {			\
+		.name	= #_name,					\
+		.value	= _name,					\
+		.set	= fjs_param_set_##_type,			\
+		.num	= _num,						\
+		.max	= ARRAY_SIZE(_name),				\
+		.size	= sizeof(_name[0]),				\
+	};								\
+	static void __attribute__((constructor)) __fjs_add_##_name(void) \
+	{								\
+		fjs_add_param(&__fjs_param_##_name);			\
+	}
+#define MODULE_PARM_DESC(_name, desc)
+
+int kstrtouint(const char *s, unsigned int base, unsigned int *res);
+bool sysfs_streq(const char *s1, const char *s2);
+int __sysfs_match_string(const char * const *array, size_t n,
+			 const char *str);
+#define sysfs_match_string(a, s)					\
+	__sysfs_match_string(a, ARRAY_SIZE(a), s)
+
+extern int fjs_verbose;
+extern bool fjs_quiet;
+
+#define fjs_log(level, fmt, ...)					\
+	do {								\
+		if (fjs_verbose >= (level))				\
+			fprintf(stderr, fmt, ##__VA_ARGS__);		\
+	} while (0)
+
+struct device;
+const char *dev_name(const struct device *dev);
+
+#define dev_printk(level, dev, fmt, ...)				\
+	fjs_log(level, "%s: " fmt, dev_name(dev), ##__VA_ARGS__)
+#define dev_err(dev, fmt, ...)		dev_printk(0, dev, fmt, ##__VA_ARGS__)
+#define dev_warn(dev, fmt, ...)		dev_printk(0, dev, fmt, ##__VA_ARGS__)
+#define dev_notice(dev, fmt, ...)	dev_printk(1, dev, fmt, ##__VA_ARGS__)
+#define dev_info(dev, fmt, ...)		dev_printk(1, dev, fmt, ##__VA_ARGS__)
+#define dev_dbg(dev, fmt, ...)		dev_printk(2, dev, fmt, ##__VA_ARGS__)
+
+/*****************************************************************************
+ *	Devices, sysfs, debugfs
+ ****************************************************************************/
+
+struct kobject {
+	const char *name;
+};
+
+struct attribute {
+	const char *name;
+	umode_t mode;
+};
+
+struct device {
+	struct kobject kobj;
+	struct device *parent;
+	const struct attribute_group *group;
+};
+
+#define kobj_to_dev(k)		container_of(k, struct device, kobj)
+
+struct device_attribute {
+	struct attribute attr;
+	ssize_t (*show)(struct device *dev, struct device_attribute *attr,
+			char *buf);
+	ssize_t (*store)(struct device *dev, struct device_attribute *attr,
+			 const char *buf, size_t count);
+};
+
+struct attribute_group {
+	struct attribute **attrs;
+	umode_t (*is_visible)(struct kobject *kobj, struct attribute *attr,
+			      int n);
+};
+
+int device_add_group(struct device *dev, const struct attribute_group *grp);
+void device_remove_group(struct device *dev,
+			 const struct attribute_group *grp);
+int fjs_store_attr(struct device *dev, const char *name, const char *val);
+
+struct seq_file {
+	void *private;
+	int (*show)(struct seq_file *m, void *v);
+};
+
+struct inode {
+	void *i_private;
+};
+
+struct file {
+	void *private_data;
+};
+
+struct file_operations {
+	void *owner;
+	int (*open)(struct inode *inode, struct file *file);
+	ssize_t (*read)(struct file *file, char *buf, size_t count,
+			long *ppos);
+	long (*llseek)(struct file *file, long offset, int whence);
+	int (*release)(struct inode *inode, struct file *file);
+};
+
+#define THIS_MODULE		NULL
+#define seq_printf(m, fmt, ...)	((void)(m), printf(fmt, ##__VA_ARGS__))
+#define seq_read		NULL
+#define seq_lseek		NULL
+
+int single_open(struct file *file, int (*show)(struct seq_file *, void *),
+		void *data);
+int single_release(struct inode *inode, struct file *file);
+
+#define DEFINE_SHOW_ATTRIBUTE(__name)					\
+static int __name##_open(struct inode *inode, struct file *file)	\
+{									\
+	return single_open(file, __name##_show, inode->i_private);	\
+}									\
+									\
+static const struct file_operations __name##_fops = {			\
+	.owner		= THIS_MODULE,					\
+	.open		= __name##_open,				\
+	.read		= seq_read,					\
+	.llseek		= seq_lseek,					\
+	.release	= single_release,				\
+}
+
+struct dentry;
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, umode_t mode,
+				   struct dentry *parent, void *data,
+				   const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+void fjs_debugfs_show(const char *name);
+
+/*****************************************************************************
+ *	Input core
+ ****************************************************************************/
+
+#define BUS_I8042		0x11
+
+struct input_id {
+	u16 bustype;
+	u16 vendor;
+	u16 product;
+	u16 version;
+};
+
+struct input_absinfo {
+	s32 minimum;
+	s32 maximum;
+};
+
+struct input_value {
+	u16 type;
+	u16 code;
+	s32 value;
+};
+
+struct input_dev {
+	const char *name;
+	const char *phys;
+	struct input_id id;
+
+	unsigned long evbit[BITS_TO_LONGS(EV_CNT)];
+	unsigned long keybit[BITS_TO_LONGS(KEY_CNT)];
+	unsigned long relbit[BITS_TO_LONGS(REL_CNT)];
+	unsigned long absbit[BITS_TO_LONGS(ABS_CNT)];
+	unsigned long mscbit[BITS_TO_LONGS(MSC_CNT)];
+	struct input_absinfo absinfo[ABS_CNT];
+
+	int (*open)(struct input_dev *dev);
+	void (*close)(struct input_dev *dev);
+
+	struct device dev;
+	void *drvdata;
+	bool registered;
+	bool opened;
+	ktime_t timestamp;
+	struct input_value vals[64];
+	unsigned int num_vals;
+	struct input_dev *next;
+};
+
+struct input_dev *input_allocate_device(void);
+void input_free_device(struct input_dev *dev);
+int input_register_device(struct input_dev *dev);
+void input_unregister_device(struct input_dev *dev);
+void input_set_capability(struct input_dev *dev, unsigned int type,
+			  unsigned int code);
+void input_set_abs_params(struct input_dev *dev, unsigned int axis,
+			  int min, int max, int fuzz, int flat);
+void input_event(struct input_dev *dev, unsigned int type,
+		 unsigned int code, int value);
+void input_set_timestamp(struct input_dev *dev, ktime_t timestamp);
+void fjs_open_inputs(void);
+
+static inline void input_set_drvdata(struct input_dev *dev, void *data)
+{
+	dev->drvdata = data;
+}
+
+static inline void *input_get_drvdata(struct input_dev *dev)
+{
+	return dev->drvdata;
+}
+
+static inline void input_report_key(struct input_dev *dev,
+				    unsigned int code, int value)
+{
+	input_event(dev, EV_KEY, code, !!value);
+}
+
+static inline void input_report_rel(struct input_dev *dev,
+				    unsigned int code, int value)
+{
+	input_event(dev, EV_REL, code, value);
+}
+
+static inline void input_report_abs(struct input_dev *dev,
+				    unsigned int code, int value)
+{
+	input_event(dev, EV_ABS, code, value);
+}
+
+static inline void input_sync(struct input_dev *dev)
+{
+	input_event(dev, EV_SYN, SYN_REPORT, 0);
+}
+
+/*****************************************************************************
+ *	Serio and libps2
+ ****************************************************************************/
+
+#define SERIO_TIMEOUT		BIT(0)
+#define SERIO_PARITY		BIT(1)
+#define SERIO_FRAME		BIT(2)
+#define SERIO_OOB_DATA		BIT(3)
+
+struct serio {
+	struct device dev;
+	void *drvdata;
+};
+
+#define to_serio_port(d)	container_of(d, struct serio, dev)
+
+static inline void serio_pause_rx(struct serio *serio)
+{
+}
+
+static inline void serio_continue_rx(struct serio *serio)
+{
+}
+
+struct ps2dev {
+	struct serio *serio;
+};
+
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+#endif /* _FJS_KERNEL_H */
@@ -0,0 +1,258 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Stand-in for the psmouse core: connects one port running the
+ * fujitsu_scroll protocol and feeds it bytes the way psmouse-base.c
+ * does.  The device behind the port is emulated just far enough for
+ * detect and init to succeed; every command is ACKed.
+ */
+
+#include <stdlib.h>
+#include "kernel.h"
+#include "psmouse.h"
+#include "fujitsu_scroll.h"
+#include "replay.h"
+
+static u8 fjs_device_id = FUJITSU_SCROLL_WHEEL_ID;
+
+struct psmouse *psmouse_from_serio(struct serio *serio)
+{
+	return serio->drvdata;
+}
+
+void psmouse_queue_work(struct psmouse *psmouse, struct delayed_work *work,
+			unsigned long delay)
+{
+	queue_delayed_work(NULL, work, delay);
+}
+
+bool psmouse_trylock(void)
+{
+	return true;
+}
+
+void psmouse_unlock(void)
+{
+}
+
+/* There is no other port, so no sibling is ever busy */
+ktime_t psmouse_sibling_activity(struct psmouse *psmouse)
+{
+	return 0;
+}
+
+int psmouse_command(struct psmouse *psmouse, u8 *param, unsigned int command)
+{
+	unsigned int send = (command >> 12) & 0xf;
+
+	psmouse_dbg(psmouse, "command 0x%04x, param 0x%02x\n",
+		    command, send ? param[0] : 0);
+
+	switch (command) {
+	case PSMOUSE_CMD_GETINFO:
+		param[0] = fjs_device_id;
+		param[1] = FUJITSU_SCROLL_ID;
+		param[2] = 0;
+		break;
+	case PSMOUSE_CMD_GETID:
+		param[0] = 0;
+		break;
+	case PSMOUSE_CMD_RESET_BAT:
+		param[0] = PSMOUSE_RET_BAT;
+		param[1] = PSMOUSE_RET_ID;
+		break;
+	}
+
+	return 0;
+}
+
+int psmouse_sliced_command(struct psmouse *psmouse, u8 command)
+{
+	psmouse_dbg(psmouse, "sliced command 0x%02x\n", command);
+	return 0;
+}
+
+int psmouse_reset(struct psmouse *psmouse)
+{
+	u8 param[2];
+
+	return psmouse_command(psmouse, param, PSMOUSE_CMD_RESET_BAT);
+}
+
+void psmouse_set_state(struct psmouse *psmouse, enum psmouse_state new_state)
+{
+	psmouse->state = new_state;
+	psmouse->pktcnt = psmouse->out_of_sync_cnt = 0;
+	psmouse->last = jiffies;
+}
+
+int psmouse_activate(struct psmouse *psmouse)
+{
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_ENABLE);
+	psmouse_set_state(psmouse, PSMOUSE_ACTIVATED);
+	return 0;
+}
+
+int psmouse_deactivate(struct psmouse *psmouse)
+{
+	psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
+	psmouse_command(psmouse, NULL, PSMOUSE_CMD_DISABLE);
+	return 0;
+}
+
+ssize_t psmouse_attr_show_helper(struct device *dev,
+				 struct device_attribute *devattr, char *buf)
+{
+	struct psmouse_attribute *attr = to_psmouse_attr(devattr);
+
+	return attr->show(psmouse_from_serio(to_serio_port(dev)),
+			  attr->data, buf);
+}
+
+ssize_t psmouse_attr_set_helper(struct device *dev,
+				struct device_attribute *devattr,
+				const char *buf, size_t count)
+{
+	struct psmouse_attribute *attr = to_psmouse_attr(devattr);
+	struct psmouse *psmouse = psmouse_from_serio(to_serio_port(dev));
+	ssize_t retval;
+
+	if (attr->protect)
+		psmouse_deactivate(psmouse);
+
+	retval = attr->set(psmouse, attr->data, buf, count);
+
+	if (attr->protect && retval != -ENODEV)
+		psmouse_activate(psmouse);
+
+	return retval;
+}
+
+/* The same steps, in the same order, as psmouse_connect() */
+struct psmouse *fjs_connect(u8 device_id)
+{
+	struct psmouse *psmouse;
+	struct serio *serio;
+
+	fjs_device_id = device_id;
+
+	psmouse = calloc(1, sizeof(*psmouse));
+	serio = calloc(1, sizeof(*serio));
+	if (!psmouse || !serio)
+		return NULL;
+
+	serio->dev.kobj.name = "serio1";
+	serio->drvdata = psmouse;
+	psmouse->ps2dev.serio = serio;
+
+	psmouse->dev = input_allocate_device();
+	if (!psmouse->dev)
+		return NULL;
+
+	psmouse->dev->phys = "isa0060/serio1/input0";
+	psmouse->rate = 100;
+	psmouse->resolution = 200;
+	psmouse->resetafter = 5;
+	psmouse_set_state(psmouse, PSMOUSE_INITIALIZING);
+
+	if (fujitsu_scroll_detect(psmouse, true) ||
+	    fujitsu_scroll_init(psmouse))
+		return NULL;
+
+	psmouse->dev->name = psmouse->name;
+	psmouse->set_rate(psmouse, psmouse->rate);
+	psmouse->set_resolution(psmouse, psmouse->resolution);
+	psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
+
+	if (psmouse->input_elsewhere) {
+		input_free_device(psmouse->dev);
+		psmouse->dev = NULL;
+	} else if (input_register_device(psmouse->dev)) {
+		return NULL;
+	}
+
+	psmouse_activate(psmouse);
+	return psmouse;
+}
+
+void fjs_disconnect(struct psmouse *psmouse)
+{
+	psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
+	psmouse->disconnect(psmouse);
+	if (psmouse->dev)
+		input_unregister_device(psmouse->dev);
+	free(psmouse->ps2dev.serio);
+	free(psmouse);
+}
+
+static psmouse_ret_t fjs_handle_byte(struct psmouse *psmouse)
+{
+	psmouse_ret_t rc = psmouse->protocol_handler(psmouse);
+
+	switch (rc) {
+	case PSMOUSE_BAD_DATA:
+		psmouse_warn(psmouse, "lost sync at byte %d\n",
+			     psmouse->pktcnt);
+		psmouse->pktcnt = 0;
+		break;
+
+	case PSMOUSE_FULL_PACKET:
+		psmouse->pktcnt = 0;
+		psmouse->last_packet = psmouse->packet_time;
+		break;
+
+	case PSMOUSE_GOOD_DATA:
+		break;
+	}
+
+	return rc;
+}
+
+/*
+ * psmouse_pre_receive_byte() and psmouse_receive_byte() for an active
+ * port.  What the core would hand to resync work or serio_reconnect()
+ * only ends the packet here: bytes with a bad parity or that timed
+ * out are dropped, as are the bytes of a packet that took longer than
+ * half a second to arrive, and a reconnect runs the protocol's
+ * reconnect handler directly.
+ */
+psmouse_ret_t fjs_receive_byte(struct psmouse *psmouse, u8 data,
+			       unsigned int flags)
+{
+	if (!psmouse->pktcnt)
+		psmouse->packet_time = ktime_get();
+
+	if (psmouse->state != PSMOUSE_ACTIVATED ||
+	    (flags & (SERIO_TIMEOUT | SERIO_PARITY | SERIO_OOB_DATA)))
+		return PSMOUSE_BAD_DATA;
+
+	if (psmouse->pktcnt && time_after(jiffies, psmouse->last + HZ / 2)) {
+		psmouse_info(psmouse, "lost sync, throwing %d bytes away\n",
+			     psmouse->pktcnt);
+		psmouse->pktcnt = 0;
+		return PSMOUSE_BAD_DATA;
+	}
+
+	psmouse->packet[psmouse->pktcnt++] = data;
+	psmouse->last = jiffies;
+
+	if (psmouse->packet[0] == PSMOUSE_RET_BAT && psmouse->pktcnt <= 2) {
+		if (psmouse->pktcnt == 1)
+			return PSMOUSE_GOOD_DATA;
+
+		if (psmouse->packet[1] == PSMOUSE_RET_ID) {
+			psmouse_notice(psmouse, "device announced BAT\n");
+			psmouse_set_state(psmouse, PSMOUSE_CMD_MODE);
+			psmouse->reconnect(psmouse);
+			psmouse_activate(psmouse);
+			return PSMOUSE_BAD_DATA;
+		}
+
+		psmouse->pktcnt = 1;
+		if (fjs_handle_byte(psmouse) == PSMOUSE_BAD_DATA)
+			return PSMOUSE_BAD_DATA;
+
+		psmouse->packet[psmouse->pktcnt++] = data;
+	}
+
+	return fjs_handle_byte(psmouse);
+}
@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Replays a recorded byte stream through fujitsu_scroll.c in userspace.
+ *
+ * The input is either a psmouse debugfs capture (struct
+ * psmouse_byte_record, the default) or, with -r, raw bytes as written to
+ * the debugfs inject file.  Time is virtual and taken from the records,
+ * so the same input always produces the same events, which are printed
+ * one per line for diffing against a known-good log.  With -t the
+ * events are not printed and the time spent per packet is measured
+ * instead.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "kernel.h"
+#include "psmouse.h"
+#include "fujitsu_scroll.h"
+#include "replay.h"
+
+#define FJS_MAX_SETTINGS	32
+
+struct fjs_setting {
+	char *name;
+	char *value;
+};
+
+static struct fjs_setting fjs_params[FJS_MAX_SETTINGS];
+static struct fjs_setting fjs_attrs[FJS_MAX_SETTINGS];
+static unsigned int fjs_num_params, fjs_num_attrs;
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options] [file]\n"
+		"  -d wheel|sensor  device to emulate (default wheel)\n"
+		"  -r               input is raw bytes, not capture records\n"
+		"  -i usec          -r packet interval (default 10000)\n"
+		"  -m name=value    set a module parameter before connecting\n"
+		"  -p name=value    write a sysfs attribute after connecting\n"
+		"  -s               print debugfs stats and rates at the end\n"
+		"  -t               time the packet path, print no events\n"
+		"  -n count         replay the input count times (default 1)\n"
+		"  -v               log driver messages, twice for commands\n",
+		prog);
+	exit(2);
+}
+
+static void add_setting(struct fjs_setting *list, unsigned int *num,
+			char *arg)
+{
+	char *eq = strchr(arg, '=');
+
+	if (!eq || *num >= FJS_MAX_SETTINGS) {
+		fprintf(stderr, "bad setting '%s'\n", arg);
+		exit(2);
+	}
+
+	*eq = '\0';
+	list[*num].name = arg;
+	list[*num].value = eq + 1;
+	(*num)++;
+}
+
+static void *read_all(FILE *f, size_t *len)
+{
+	size_t size = 1 << 16;
+	char *buf = malloc(size);
+	size_t n;
+
+	*len = 0;
+	while (buf && (n = fread(buf + *len, 1, size - *len, f)) > 0) {
+		*len += n;
+		if (*len == size)
+			buf = realloc(buf, size *= 2);
+	}
+
+	if (!buf || ferror(f)) {
+		fprintf(stderr, "failed to read input\n");
+		exit(1);
+	}
+
+	return buf;
+}
+
+/* Turns raw bytes into records, pktsize bytes every interval */
+static struct psmouse_byte_record *raw_to_records(const u8 *raw, size_t len,
+						  u64 interval_ns)
+{
+	struct psmouse_byte_record *recs = calloc(len, sizeof(*recs));
+	size_t i;
+
+	for (i = 0; recs && i < len; i++) {
+		recs[i].time_ns = NSEC_PER_SEC +
+				  i / FJS_PACKET_SIZE * interval_ns;
+		recs[i].data = raw[i];
+		recs[i].state = PSMOUSE_ACTIVATED;
+	}
+
+	return recs;
+}
+
+static u64 now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int main(int argc, char **argv)
+{
+	u8 device_id = FUJITSU_SCROLL_WHEEL_ID;
+	struct psmouse_byte_record *recs;
+	u64 interval_ns = 10 * NSEC_PER_MSEC;
+	u64 start = 0, elapsed, total_ns = 0, max_ns = 0;
+	unsigned long packets = 0, count = 1, n;
+	bool raw = false, stats = false;
+	ktime_t first, last, offset;
+	struct psmouse *psmouse;
+	psmouse_ret_t ret;
+	size_t len, nrecs, i;
+	FILE *f = stdin;
+	void *buf;
+	int c, error;
+
+	while ((c = getopt(argc, argv, "d:ri:m:p:stn:vh")) != -1) {
+		switch (c) {
+		case 'd':
+			if (!strcmp(optarg, "wheel"))
+				device_id = FUJITSU_SCROLL_WHEEL_ID;
+			else if (!strcmp(optarg, "sensor"))
+				device_id = FUJITSU_SCROLL_SENSOR_ID;
+			else
+				usage(argv[0]);
+			break;
+		case 'r':
+			raw = true;
+			break;
+		case 'i':
+			interval_ns = strtoull(optarg, NULL, 0) * NSEC_PER_USEC;
+			break;
+		case 'm':
+			add_setting(fjs_params, &fjs_num_params, optarg);
+			break;
+		case 'p':
+			add_setting(fjs_attrs, &fjs_num_attrs, optarg);
+			break;
+		case 's':
+			stats = true;
+			break;
+		case 't':
+			fjs_quiet = true;
+			break;
+		case 'n':
+			count = strtoul(optarg, NULL, 0);
+			break;
+		case 'v':
+			fjs_verbose++;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (optind < argc - 1)
+		usage(argv[0]);
+	if (optind == argc - 1 && !(f = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	buf = read_all(f, &len);
+	if (raw) {
+		nrecs = len;
+		recs = raw_to_records(buf, len, interval_ns);
+		free(buf);
+	} else {
+		nrecs = len / sizeof(*recs);
+		recs = buf;
+	}
+
+	if (!recs || !nrecs) {
+		fprintf(stderr, "no input\n");
+		return 1;
+	}
+
+	for (i = 0; i < fjs_num_params; i++) {
+		error = fjs_set_param(fjs_params[i].name, fjs_params[i].value);
+		if (error) {
+			fprintf(stderr, "module parameter %s: %s\n",
+				fjs_params[i].name, strerror(-error));
+			return 1;
+		}
+	}
+
+	/* Connect a second before the first byte, as if at boot */
+	first = le64_to_cpu(recs[0].time_ns);
+	last = le64_to_cpu(recs[nrecs - 1].time_ns);
+	fjs_run_until(first - NSEC_PER_SEC);
+
+	fujitsu_scroll_module_init();
+	psmouse = fjs_connect(device_id);
+	if (!psmouse) {
+		fprintf(stderr, "failed to connect\n");
+		return 1;
+	}
+
+	for (i = 0; i < fjs_num_attrs; i++) {
+		error = fjs_store_attr(&psmouse->ps2dev.serio->dev,
+				       fjs_attrs[i].name, fjs_attrs[i].value);
+		if (error) {
+			fprintf(stderr, "attribute %s: %s\n",
+				fjs_attrs[i].name, strerror(-error));
+			return 1;
+		}
+	}
+
+	fjs_open_inputs();
+
+	/* Repeats start a second after the previous pass ended */
+	for (n = 0, offset = 0; n < count; n++) {
+		for (i = 0; i < nrecs; i++) {
+			fjs_run_until(le64_to_cpu(recs[i].time_ns) + offset);
+
+			/* Bytes the handler did not see when captured */
+			if (recs[i].state != PSMOUSE_ACTIVATED)
+				continue;
+
+			if (!psmouse->pktcnt)
+				start = now_ns();
+
+			ret = fjs_receive_byte(psmouse, recs[i].data,
+					       recs[i].flags);
+			if (ret != PSMOUSE_FULL_PACKET)
+				continue;
+
+			elapsed = now_ns() - start;
+			packets++;
+			total_ns += elapsed;
+			max_ns = max(max_ns, elapsed);
+		}
+
+		offset += last - first + NSEC_PER_SEC;
+	}
+
+	/* Let timers started by the last packets run out */
+	fjs_run_until(first + offset);
+
+	if (fjs_quiet)
+		printf("packets: %lu\navg_ns: %llu\nmax_ns: %llu\n", packets,
+		       packets ? (unsigned long long)(total_ns / packets) : 0,
+		       (unsigned long long)max_ns);
+
+	if (stats) {
+		fjs_debugfs_show("stats");
+		fjs_debugfs_show("rates");
+	}
+
+	fjs_disconnect(psmouse);
+	fujitsu_scroll_module_exit();
+	free(recs);
+
+	return 0;
+}
@@ -0,0 +1,10 @@
+/* SPDX-License-Identifier: GPL-2.0-only */
+#ifndef _FJS_REPLAY_H
+#define _FJS_REPLAY_H
+
+struct psmouse *fjs_connect(u8 device_id);
+void fjs_disconnect(struct psmouse *psmouse);
+psmouse_ret_t fjs_receive_byte(struct psmouse *psmouse, u8 data,
+			       unsigned int flags);
+
+#endif /* _FJS_REPLAY_H */